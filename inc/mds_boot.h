@@ -36,11 +36,91 @@ extern "C" {
 
 #define MDS_BOOT_CHKHASH_SIZE 0x20
 
+// room for the sha256 state of mds_component_algo or of a digest provider
+#ifndef MDS_BOOT_DIGEST_SIZE
+#define MDS_BOOT_DIGEST_SIZE 0x70
+#endif
+
+#define MDS_BOOT_CRYPT_BLOCK    0x10
+#define MDS_BOOT_CRYPT_KEY_SIZE 0x10
+
+#ifndef MDS_BOOT_CHECK_SIZE
+#define MDS_BOOT_CHECK_SIZE 1024
+#endif
+
+#ifndef MDS_BOOT_PAGE_SIZE
+#define MDS_BOOT_PAGE_SIZE 256
+#endif
+
+#ifndef MDS_BOOT_SECTOR_SIZE
+#define MDS_BOOT_SECTOR_SIZE 4096
+#endif
+
+#ifndef MDS_BOOT_LZMA_READ_SIZE
+#define MDS_BOOT_LZMA_READ_SIZE 1024
+#endif
+
+#ifndef MDS_BOOT_LZMA_DICT_SIZE
+#define MDS_BOOT_LZMA_DICT_SIZE 4096
+#endif
+
+#ifndef MDS_BOOT_LZMA_PROBS_SIZE
+#define MDS_BOOT_LZMA_PROBS_SIZE 10112
+#endif
+
+#ifndef MDS_BOOT_LZ4_READ_SIZE
+#define MDS_BOOT_LZ4_READ_SIZE 512
+#endif
+
+#ifndef MDS_BOOT_LZ4_BLOCK_SIZE
+#define MDS_BOOT_LZ4_BLOCK_SIZE 4096
+#endif
+
+#ifndef MDS_BOOT_DELTA_SIZE
+#define MDS_BOOT_DELTA_SIZE 512
+#endif
+
+#ifndef MDS_BOOT_WITH_ASYNC
+#define MDS_BOOT_WITH_ASYNC 0
+#endif
+
+#ifndef MDS_BOOT_WITH_CRYPT
+#define MDS_BOOT_WITH_CRYPT 0
+#endif
+
+#define MDS_BOOT_SLOT_NUM 2
+
+#ifndef MDS_BOOT_SLOT_TRIAL
+#define MDS_BOOT_SLOT_TRIAL 3
+#endif
+
+// chunks of MDS_BOOT_CHECK_SIZE read back from the installed image to accept a package as installed, 0 trusts the hash
+#ifndef MDS_BOOT_SAMPLE_NUM
+#define MDS_BOOT_SAMPLE_NUM 0
+#endif
+
+#ifndef MDS_BOOT_WITH_TRACE
+#define MDS_BOOT_WITH_TRACE 0
+#endif
+
+#define MDS_BOOT_TRACE_VERSION 2
+
 /* Typedef ----------------------------------------------------------------- */
+struct MDS_BOOT_UpgradeOps;
+
 typedef struct {
     void *arg;
+    const struct MDS_BOOT_UpgradeOps *ops;  // optional, ops of this device instead of the upgrade ops
+    uintptr_t ofs;                           // optional, base of the region on the device, added to every access
+    size_t size;                             // optional, size of the region, 0 for the whole device
 } MDS_BOOT_Device_t;
 
+// sha256 state laid out by whoever hashes, persisted as it is by the checkpoint
+typedef union MDS_BOOT_Digest {
+    uint64_t align;
+    uint8_t state[MDS_BOOT_DIGEST_SIZE];
+} MDS_BOOT_Digest_t;
+
 typedef enum MDS_BOOT_Result {
     MDS_BOOT_RESULT_NONE = 0x0000,
     MDS_BOOT_RESULT_SUCCESS = 0xE000,
@@ -48,13 +128,48 @@ typedef enum MDS_BOOT_Result {
     MDS_BOOT_RESULT_ERETRY,
     MDS_BOOT_RESULT_EIO,
     MDS_BOOT_RESULT_ENOMEM,
+    MDS_BOOT_RESULT_EVERIFY,
+    MDS_BOOT_RESULT_EAGAIN,  // a step spent its budget, the upgrade goes on with the next step
     MDS_BOOT_RESULT_ELZMA = 0xE200,
+    MDS_BOOT_RESULT_EDELTA = 0xE300,
+    MDS_BOOT_RESULT_ELZ4 = 0xE400,
+    MDS_BOOT_RESULT_ECRYPT = 0xE500,
 } MDS_BOOT_Result_t;
 
+// phases never nest, the rest of the upgrade ticks is spent in the library itself and in decoders without a phase
+enum MDS_BOOT_TRACE {
+    MDS_BOOT_TRACE_CHECK = 0,  // crc of headers, swap info and lzma blocks
+    MDS_BOOT_TRACE_HASH,       // sha256 of the package and bins
+    MDS_BOOT_TRACE_READ,
+    MDS_BOOT_TRACE_WRITE,  // program and swap info sync
+    MDS_BOOT_TRACE_ERASE,
+    MDS_BOOT_TRACE_DECODE,  // lzma decoder
+    MDS_BOOT_TRACE_CRYPT,   // keystream of encrypted bins
+    MDS_BOOT_TRACE_NUM,
+};
+
+enum MDS_BOOT_SLOT {
+    MDS_BOOT_SLOT_CONFIRMED = 0,
+    MDS_BOOT_SLOT_PENDING,   // the active image waits for the application to confirm it
+    MDS_BOOT_SLOT_ROLLBACK,  // the package recorded in swap info was rolled back and is not installed again
+};
+
+enum MDS_BOOT_STEP {
+    MDS_BOOT_STEP_OPEN = 0,  // read the package header
+    MDS_BOOT_STEP_CHECK,     // hash the package and its bins
+    MDS_BOOT_STEP_INSTALL,   // install into the inactive slot, resumed from the checkpoint by every step
+    MDS_BOOT_STEP_DONE,
+};
+
 enum MDS_BOOT_FLAG {
     MDS_BOOT_FLAG_NONE = 0x0000,
     MDS_BOOT_FLAG_COPY = 0x0001,
+    MDS_BOOT_FLAG_LZ4 = 0x0010,
     MDS_BOOT_FLAG_LZMA = 0x0020,
+    MDS_BOOT_FLAG_LZMA_BLOCK = 0x0021,
+    MDS_BOOT_FLAG_DELTA = 0x0040,
+    MDS_BOOT_FLAG_DELTA_LZMA = MDS_BOOT_FLAG_DELTA | MDS_BOOT_FLAG_LZMA,
+    MDS_BOOT_FLAG_CRYPT = 0x0080,  // with any of the above, the bin is aes-ctr encrypted behind its crypt info
 };
 
 typedef struct MDS_BOOT_BinInfo {
@@ -67,6 +182,43 @@ typedef struct MDS_BOOT_BinInfo {
     // context of `uint8_t data[srcSize]` for upgrade bin
 } MDS_BOOT_BinInfo_t;
 
+typedef struct MDS_BOOT_BlockEntry {
+    uint8_t ofs[sizeof(uint32_t)];    // offset of the compressed block behind the entry table
+    uint8_t size[sizeof(uint32_t)];   // size of the compressed block
+    uint8_t check[sizeof(uint16_t)];  // crc16 of the unpacked block
+} MDS_BOOT_BlockEntry_t;
+
+typedef struct MDS_BOOT_BlockInfo {
+    uint8_t props[0x05];                   // lzma props shared by every block
+    uint8_t count[sizeof(uint16_t)];       // count of blocks
+    uint8_t blockSize[sizeof(uint32_t)];   // unpack size of every block except the last one
+    uint8_t unpackSize[sizeof(uint32_t)];  // total unpack size
+
+    // context of `MDS_BOOT_BlockEntry_t entry[count]` and the independent compressed blocks for lzma block bin
+} MDS_BOOT_BlockInfo_t;
+
+typedef struct MDS_BOOT_Lz4Info {
+    uint8_t blockSize[sizeof(uint32_t)];   // unpack size of every block except the last one
+    uint8_t unpackSize[sizeof(uint32_t)];  // total unpack size
+
+    // context of every block as `uint8_t size[sizeof(uint32_t)]` and `uint8_t data[size & 0x7FFFFFFF]` for lz4 bin,
+    // an independent lz4 block, or the unpacked block itself when the top bit of size is set
+} MDS_BOOT_Lz4Info_t;
+
+typedef struct MDS_BOOT_DeltaInfo {
+    uint8_t oldSize[sizeof(uint32_t)];  // size of the installed image the patch applies to
+    uint8_t newSize[sizeof(uint32_t)];  // size of the patched image
+    uint8_t hash[MDS_BOOT_CHKHASH_SIZE];
+
+    // context of `{diffLen, extraLen, seek} diff[diffLen] extra[extraLen]` records for delta bin
+} MDS_BOOT_DeltaInfo_t;
+
+typedef struct MDS_BOOT_CryptInfo {
+    uint8_t iv[MDS_BOOT_CRYPT_BLOCK];  // counter block of the first encrypted byte, never reused under one key
+
+    // context of the bin encrypted as `uint8_t data[srcSize - sizeof(MDS_BOOT_CryptInfo_t)]` for crypt bin
+} MDS_BOOT_CryptInfo_t;
+
 typedef struct MDS_BOOT_UpgradeInfo {
     uint8_t check[sizeof(uint16_t)];  // check upgradeInfo header
     uint8_t magic[sizeof(uint32_t)];  // magic for firmware check
@@ -77,6 +229,28 @@ typedef struct MDS_BOOT_UpgradeInfo {
     // context of `MDS_BOOT_BinInfo_t binInfo[count]` for upgrade bin combain
 } MDS_BOOT_UpgradeInfo_t;
 
+typedef struct MDS_BOOT_Checkpoint {
+    uint16_t index;   // bin in progress
+    uint16_t phase;   // engine step of the bin in progress
+    uint32_t binOfs;  // source offset of the bin in progress
+    uint32_t dstOfs;  // destination committed up to this offset for the bin in progress
+    MDS_BOOT_Digest_t digest;  // package digest before the bin in progress
+} MDS_BOOT_Checkpoint_t;
+
+typedef struct MDS_BOOT_SlotInfo {
+    uint8_t active;    // slot started by the bootloader
+    uint8_t previous;  // slot rolled back to when the active image is not confirmed
+    uint8_t trial;     // boots left to confirm the active image
+    uint8_t state;     // MDS_BOOT_SLOT_*, a cleared record is a confirmed slot 0
+} MDS_BOOT_SlotInfo_t;
+
+typedef struct MDS_BOOT_InstallInfo {
+    uint8_t hash[MDS_BOOT_CHKHASH_SIZE];    // package hash of the last completed install, cleared once dst is written
+    uint32_t size;                          // destination span the samples are spread over
+    uint8_t sample[MDS_BOOT_CHKHASH_SIZE];  // digest of the samples taken right after the install
+    uint8_t image[MDS_BOOT_CHKHASH_SIZE];   // digest of the whole span as programmed, with verified installs
+} MDS_BOOT_InstallInfo_t;
+
 typedef struct MDS_BOOT_SwapInfo {
     uint16_t check;
     uint32_t magic;
@@ -88,27 +262,174 @@ typedef struct MDS_BOOT_SwapInfo {
     uint16_t version;
     uint32_t reset;
     uint32_t result;
+
+    MDS_BOOT_SlotInfo_t slot;
+    MDS_BOOT_InstallInfo_t install;
+    MDS_BOOT_Checkpoint_t checkpoint;
 } MDS_BOOT_SwapInfo_t;
 
 typedef struct MDS_BOOT_UpgradeOps {
     int (*read)(MDS_BOOT_Device_t *dev, uintptr_t ofs, uint8_t *data, size_t len);
     int (*write)(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *data, size_t len);
     int (*erase)(MDS_BOOT_Device_t *dev);
+    int (*sync)(const MDS_BOOT_SwapInfo_t *swapInfo);  // optional, persist swapInfo across power loss
+    int (*eraseSector)(MDS_BOOT_Device_t *dev, uintptr_t ofs, size_t len);  // optional, erase sectors in range
+
+    // optional, start a transfer and return, wait blocks until the device transfer is done and returns its result
+    int (*readSubmit)(MDS_BOOT_Device_t *dev, uintptr_t ofs, uint8_t *data, size_t len);
+    int (*writeSubmit)(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *data, size_t len);
+    int (*wait)(MDS_BOOT_Device_t *dev);
+
+    void *(*map)(MDS_BOOT_Device_t *dev, uintptr_t ofs, size_t len, bool write);  // optional, direct pointer or NULL
+
+    uint32_t sectorSize;  // optional, erase granularity, enables lazy erase with eraseSector
+    uint32_t pageSize;    // optional, program page size, writes are gathered into full pages
+    uint32_t alignSize;   // optional, program alignment of a partial page
+    bool reprogram;       // optional, with verify a page whose read back differs is programmed again, else EVERIFY
 } MDS_BOOT_UpgradeOps_t;
 
+// a provider keeps its engine state in ctx, which is persisted by the checkpoint and may be one of several in progress
+typedef struct MDS_BOOT_DigestOps {
+    int (*init)(MDS_BOOT_Digest_t *ctx);  // optional with update and finish, all three or none
+    int (*update)(MDS_BOOT_Digest_t *ctx, const uint8_t *data, size_t len);
+    int (*finish)(MDS_BOOT_Digest_t *ctx, uint8_t hash[MDS_BOOT_CHKHASH_SIZE]);
+
+    // optional, start hashing data and return, wait blocks until it is hashed or at once when nothing is in flight
+    int (*updateSubmit)(MDS_BOOT_Digest_t *ctx, const uint8_t *data, size_t len);
+    int (*wait)(MDS_BOOT_Digest_t *ctx);
+
+    uint16_t (*crc16)(uint16_t crc, const uint8_t *data, size_t len);  // optional, the same result as ALGO_CRC16
+} MDS_BOOT_DigestOps_t;
+
+// the key stays in the engine when ctr is given, the software aes fallback takes it from key
+typedef struct MDS_BOOT_CryptOps {
+    const uint8_t *key;  // optional with ctr, MDS_BOOT_CRYPT_KEY_SIZE bytes of aes-128 key
+
+    // optional, xor the aes-ctr keystream starting at counter into data, len is whole blocks
+    int (*ctr)(const uint8_t counter[MDS_BOOT_CRYPT_BLOCK], uint8_t *data, size_t len);
+} MDS_BOOT_CryptOps_t;
+
+typedef struct MDS_BOOT_TraceStat {
+    uint32_t calls;
+    uint32_t bytes;
+    uint32_t ticks;
+} MDS_BOOT_TraceStat_t;
+
+// kept behind the swap info in the swap section for the application, a reader checks version and size first
+typedef struct MDS_BOOT_TraceInfo {
+    uint16_t check;
+    uint16_t version;  // MDS_BOOT_TRACE_VERSION
+    uint16_t size;     // sizeof(MDS_BOOT_TraceInfo_t), a later version only appends
+    uint16_t count;    // phases recorded
+    uint32_t result;
+    uint32_t ticks;  // the whole upgrade check
+    MDS_BOOT_TraceStat_t phase[MDS_BOOT_TRACE_NUM];
+} MDS_BOOT_TraceInfo_t;
+
+typedef struct MDS_BOOT_UpgradeStat {
+    uint32_t sectors;       // sectors written by the upgrade
+    uint32_t erased;        // sectors erased and programmed
+    uint32_t programmed;    // sectors programmed without erase, differing bytes were blank
+    uint32_t skipped;       // sectors already holding the data, neither erased nor programmed
+    uint32_t reprogrammed;  // pages programmed again after their read back differed
+    uint32_t arenaSize;     // bytes of the working buffer arena
+    uint32_t arenaPeak;     // most bytes of the arena in use at once
+} MDS_BOOT_UpgradeStat_t;
+
+// arena bytes each phase takes at most, fixed at build time, the arena is sized for the largest
+typedef struct MDS_BOOT_ArenaReport {
+    uint32_t check;   // hashing and copy
+    uint32_t page;    // page buffers and the read back buffer, held through a whole bin
+    uint32_t sector;  // compare buffer, held through a whole bin
+    uint32_t lz4;     // lz4 block and read buffers
+    uint32_t lzma;    // lzma probs, dictionary and read buffers
+    uint32_t delta;   // delta buffers, and the lzma decoder of a compressed patch
+    uint32_t size;
+} MDS_BOOT_ArenaReport_t;
+
+typedef struct MDS_BOOT_Partition {
+    uint32_t addr;           // first dstAddr of the partition, bins start on a sector boundary of the device
+    uint32_t size;           // size of the partition, whole sectors
+    MDS_BOOT_Device_t *dev;  // device holding the partition at dev->ofs
+} MDS_BOOT_Partition_t;
+
+// a package delivered by a transport, uart, usb dfu or a card reader, instead of a random access device
+typedef struct MDS_BOOT_Stream {
+    void *arg;
+    int (*pull)(void *arg, uint8_t *data, size_t len);  // block until the next len bytes of the package arrived
+} MDS_BOOT_Stream_t;
+
+typedef uint32_t (*MDS_BOOT_Tick_t)(void);
+typedef MDS_BOOT_Result_t (*MDS_BOOT_Upgrade_t)(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                                uint32_t srcSize);
+
+typedef struct MDS_BOOT_Codec {
+    uint16_t flag;               // bin flag the codec installs
+    MDS_BOOT_Upgrade_t upgrade;  // install the bin payload to dst
+    MDS_BOOT_Upgrade_t reserve;  // optional, take from the arena what upgrade takes, without writing anything
+} MDS_BOOT_Codec_t;
+
+// an upgrade run step by step from the application, every step starts from here and the swap info, nothing else
+typedef struct MDS_BOOT_UpgradeStep {
+    MDS_BOOT_SwapInfo_t *swapInfo;
+    MDS_BOOT_Device_t *slot[MDS_BOOT_SLOT_NUM];
+    MDS_BOOT_Device_t *src;
+    const MDS_BOOT_UpgradeOps_t *ops;
+
+    uint16_t state;            // MDS_BOOT_STEP_*
+    uint16_t index;            // bin checked next
+    uint32_t ofs;              // package checked up to here
+    uint32_t binEnd;           // end of the bin being checked, 0 between bins
+    uint32_t size;             // furthest write to the slot over all steps
+    MDS_BOOT_Result_t result;  // of the finished upgrade, returned by every later step
+    MDS_BOOT_UpgradeInfo_t upgradeInfo;
+    MDS_BOOT_BinInfo_t binInfo;  // bin being checked
+    MDS_BOOT_Digest_t total;     // package digest up to ofs
+    MDS_BOOT_Digest_t bin;       // digest of the bin being checked
+} MDS_BOOT_UpgradeStep_t;
+
 /* Function ---------------------------------------------------------------- */
+// flash driver of the devices without ops of their own with mds_boot_with_static, linked in by the platform,
+// ofs is absolute and erase clears a device without a size
+extern int MDS_BOOT_StaticRead(MDS_BOOT_Device_t *dev, uintptr_t ofs, uint8_t *data, size_t len);
+extern int MDS_BOOT_StaticWrite(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *data, size_t len);
+extern int MDS_BOOT_StaticErase(MDS_BOOT_Device_t *dev);
+extern int MDS_BOOT_StaticEraseSector(MDS_BOOT_Device_t *dev, uintptr_t ofs, size_t len);
+
 extern int MDS_BOOT_DeviceRead(MDS_BOOT_Device_t *dev, uintptr_t ofs, uint8_t *buff, size_t size);
 extern int MDS_BOOT_DeviceWrite(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *buff, size_t size);
 extern int MDS_BOOT_DeviceErase(MDS_BOOT_Device_t *dev);
+extern int MDS_BOOT_DeviceEraseSector(MDS_BOOT_Device_t *dev, uintptr_t ofs, size_t size);
+extern int MDS_BOOT_DeviceWait(MDS_BOOT_Device_t *dev);
+extern void *MDS_BOOT_DeviceMap(MDS_BOOT_Device_t *dev, uintptr_t ofs, size_t size, bool write);
+extern const MDS_BOOT_ArenaReport_t *MDS_BOOT_GetArenaReport(void);
 
 extern MDS_BOOT_Result_t MDS_BOOT_UpgradeCheck(MDS_BOOT_SwapInfo_t *swapInfo, MDS_BOOT_Device_t *dst,
                                                MDS_BOOT_Device_t *src, const MDS_BOOT_UpgradeOps_t *ops);
+extern MDS_BOOT_Result_t MDS_BOOT_UpgradeStream(MDS_BOOT_SwapInfo_t *swapInfo,
+                                                MDS_BOOT_Device_t *slot[MDS_BOOT_SLOT_NUM],
+                                                const MDS_BOOT_Stream_t *stream, const MDS_BOOT_UpgradeOps_t *ops);
+extern MDS_BOOT_Result_t MDS_BOOT_UpgradeSlot(MDS_BOOT_SwapInfo_t *swapInfo, MDS_BOOT_Device_t *slot[MDS_BOOT_SLOT_NUM],
+                                              MDS_BOOT_Device_t *src, const MDS_BOOT_UpgradeOps_t *ops);
+extern void MDS_BOOT_UpgradeStepOpen(MDS_BOOT_UpgradeStep_t *step, MDS_BOOT_SwapInfo_t *swapInfo,
+                                     MDS_BOOT_Device_t *slot[MDS_BOOT_SLOT_NUM], MDS_BOOT_Device_t *src,
+                                     const MDS_BOOT_UpgradeOps_t *ops);
+extern MDS_BOOT_Result_t MDS_BOOT_UpgradeStep(MDS_BOOT_UpgradeStep_t *step, size_t budget);
+extern uint8_t MDS_BOOT_SlotSelect(MDS_BOOT_SwapInfo_t *swapInfo);
+extern void MDS_BOOT_SlotConfirm(MDS_BOOT_SwapInfo_t *swapInfo);
 extern MDS_BOOT_SwapInfo_t *MDS_BOOT_GetSwapInfo(void);
+extern const MDS_BOOT_UpgradeStat_t *MDS_BOOT_GetUpgradeStat(void);
+extern void MDS_BOOT_SetStageDevice(MDS_BOOT_Device_t *stage);
+extern MDS_BOOT_Device_t *MDS_BOOT_GetStageDevice(void);
+extern void MDS_BOOT_SetPartitionTable(const MDS_BOOT_Partition_t *table, uint16_t count);
+extern void MDS_BOOT_SetCodecTable(const MDS_BOOT_Codec_t *table, uint16_t count);
+extern void MDS_BOOT_SetDigestOps(const MDS_BOOT_DigestOps_t *ops);
+extern void MDS_BOOT_SetCryptOps(const MDS_BOOT_CryptOps_t *ops);
+extern void MDS_BOOT_SetTickHook(MDS_BOOT_Tick_t tick);
+extern const MDS_BOOT_TraceInfo_t *MDS_BOOT_GetTraceInfo(void);
 
-extern MDS_BOOT_Result_t MDS_BOOT_UpgradeCopy(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
-                                              uint32_t srcSize);
-extern MDS_BOOT_Result_t MDS_BOOT_UpgradeLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
-                                              uint32_t srcSize);
+extern void MDS_BOOT_CryptCtr(const uint8_t key[MDS_BOOT_CRYPT_KEY_SIZE], const uint8_t counter[MDS_BOOT_CRYPT_BLOCK],
+                              uint8_t *data, size_t len);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+/* Include ----------------------------------------------------------------- */
+#include "mds_boot.h"
+
+/* Define ------------------------------------------------------------------ */
+#define BOOT_AES_ROUNDS   10
+#define BOOT_AES_RK_SIZE  (MDS_BOOT_CRYPT_BLOCK * (BOOT_AES_ROUNDS + 1))
+#define BOOT_AES_XTIME(x) ((uint8_t)(((x) << 1) ^ ((((x) >> 7) & 0x01) * 0x1B)))
+
+/* Variable ---------------------------------------------------------------- */
+static const uint8_t G_BOOT_AES_SBOX[0x100] = {
+    0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76, 0xCA, 0x82, 0xC9,
+    0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0, 0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F,
+    0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15, 0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07,
+    0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75, 0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3,
+    0x29, 0xE3, 0x2F, 0x84, 0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58,
+    0xCF, 0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8, 0x51, 0xA3,
+    0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2, 0xCD, 0x0C, 0x13, 0xEC, 0x5F,
+    0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73, 0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88,
+    0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB, 0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC,
+    0x62, 0x91, 0x95, 0xE4, 0x79, 0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A,
+    0xAE, 0x08, 0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A, 0x70,
+    0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E, 0xE1, 0xF8, 0x98, 0x11,
+    0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF, 0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42,
+    0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16,
+};
+
+/* Function ---------------------------------------------------------------- */
+static void BOOT_AesExpand(const uint8_t key[MDS_BOOT_CRYPT_KEY_SIZE], uint8_t rk[BOOT_AES_RK_SIZE])
+{
+    uint8_t rcon = 0x01;
+
+    for (size_t i = 0; i < MDS_BOOT_CRYPT_KEY_SIZE; i++) {
+        rk[i] = key[i];
+    }
+
+    for (size_t i = MDS_BOOT_CRYPT_KEY_SIZE; i < BOOT_AES_RK_SIZE; i += sizeof(uint32_t)) {
+        uint8_t t[sizeof(uint32_t)] = {rk[i - 0x04], rk[i - 0x03], rk[i - 0x02], rk[i - 0x01]};
+
+        if ((i % MDS_BOOT_CRYPT_KEY_SIZE) == 0) {
+            uint8_t t0 = t[0];
+            t[0x00] = G_BOOT_AES_SBOX[t[0x01]] ^ rcon;
+            t[0x01] = G_BOOT_AES_SBOX[t[0x02]];
+            t[0x02] = G_BOOT_AES_SBOX[t[0x03]];
+            t[0x03] = G_BOOT_AES_SBOX[t0];
+            rcon = BOOT_AES_XTIME(rcon);
+        }
+
+        for (size_t j = 0; j < sizeof(uint32_t); j++) {
+            rk[i + j] = rk[i + j - MDS_BOOT_CRYPT_KEY_SIZE] ^ t[j];
+        }
+    }
+}
+
+static void BOOT_AesEncrypt(const uint8_t rk[BOOT_AES_RK_SIZE], const uint8_t in[MDS_BOOT_CRYPT_BLOCK],
+                            uint8_t out[MDS_BOOT_CRYPT_BLOCK])
+{
+    uint8_t s[MDS_BOOT_CRYPT_BLOCK];
+
+    for (size_t i = 0; i < MDS_BOOT_CRYPT_BLOCK; i++) {
+        s[i] = in[i] ^ rk[i];
+    }
+
+    for (size_t round = 1; round <= BOOT_AES_ROUNDS; round++) {
+        uint8_t t[MDS_BOOT_CRYPT_BLOCK];
+
+        // sub bytes and shift rows, the state is column major
+        for (size_t i = 0; i < MDS_BOOT_CRYPT_BLOCK; i++) {
+            t[i] = G_BOOT_AES_SBOX[s[(i + ((i & 0x03) << 0x02)) & 0x0F]];
+        }
+
+        if (round < BOOT_AES_ROUNDS) {
+            for (size_t c = 0; c < MDS_BOOT_CRYPT_BLOCK; c += sizeof(uint32_t)) {
+                uint8_t a0 = t[c], a1 = t[c + 0x01], a2 = t[c + 0x02], a3 = t[c + 0x03];
+                uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+                t[c] = a0 ^ all ^ BOOT_AES_XTIME(a0 ^ a1);
+                t[c + 0x01] = a1 ^ all ^ BOOT_AES_XTIME(a1 ^ a2);
+                t[c + 0x02] = a2 ^ all ^ BOOT_AES_XTIME(a2 ^ a3);
+                t[c + 0x03] = a3 ^ all ^ BOOT_AES_XTIME(a3 ^ a0);
+            }
+        }
+
+        for (size_t i = 0; i < MDS_BOOT_CRYPT_BLOCK; i++) {
+            s[i] = t[i] ^ rk[(round * MDS_BOOT_CRYPT_BLOCK) + i];
+        }
+    }
+
+    for (size_t i = 0; i < MDS_BOOT_CRYPT_BLOCK; i++) {
+        out[i] = s[i];
+    }
+}
+
+// xor the keystream from counter on into data, the counter is a 128-bit big-endian block number
+void MDS_BOOT_CryptCtr(const uint8_t key[MDS_BOOT_CRYPT_KEY_SIZE], const uint8_t counter[MDS_BOOT_CRYPT_BLOCK],
+                       uint8_t *data, size_t len)
+{
+    uint8_t rk[BOOT_AES_RK_SIZE];
+    uint8_t ctr[MDS_BOOT_CRYPT_BLOCK];
+    uint8_t stream[MDS_BOOT_CRYPT_BLOCK];
+
+    BOOT_AesExpand(key, rk);
+    for (size_t i = 0; i < MDS_BOOT_CRYPT_BLOCK; i++) {
+        ctr[i] = counter[i];
+    }
+
+    for (size_t ofs = 0; ofs < len; ofs += MDS_BOOT_CRYPT_BLOCK) {
+        BOOT_AesEncrypt(rk, ctr, stream);
+        for (size_t i = 0; (i < MDS_BOOT_CRYPT_BLOCK) && ((ofs + i) < len); i++) {
+            data[ofs + i] ^= stream[i];
+        }
+
+        for (size_t i = MDS_BOOT_CRYPT_BLOCK; i > 0; i--) {
+            if (++ctr[i - 1] != 0) {
+                break;
+            }
+        }
+    }
+}
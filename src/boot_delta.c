@@ -0,0 +1,419 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+/* Include ----------------------------------------------------------------- */
+#include "boot_internal.h"
+#include "algo_common.h"
+
+/* Define ------------------------------------------------------------------ */
+#define BOOT_DELTA_CTRL_SIZE (sizeof(uint32_t) + sizeof(uint32_t) + sizeof(int32_t))
+
+enum BOOT_DeltaState {
+    BOOT_DELTA_STATE_INFO,
+    BOOT_DELTA_STATE_CTRL,
+    BOOT_DELTA_STATE_DIFF,
+    BOOT_DELTA_STATE_EXTRA,
+};
+
+enum BOOT_DeltaPhase {
+    BOOT_DELTA_PHASE_PATCH = 0,
+    BOOT_DELTA_PHASE_COMMIT,
+};
+
+/* Variable ---------------------------------------------------------------- */
+static uint8_t *g_deltaReadBuff = NULL;
+static uint8_t *g_deltaOldBuff = NULL;
+static uint8_t *g_deltaOutBuff = NULL;
+
+static struct BOOT_Delta {
+    MDS_BOOT_Device_t *base;  // installed image the patch applies to
+    MDS_BOOT_Device_t *stage;
+    MDS_BOOT_Result_t result;
+    enum BOOT_DeltaState state;
+
+    MDS_BOOT_DeltaInfo_t info;
+    uint8_t ctrl[BOOT_DELTA_CTRL_SIZE];
+    size_t headLen;
+
+    uint32_t oldSize, newSize;
+    uint32_t oldPos, newPos;
+    uint32_t diffLen, extraLen;
+    int32_t seek;
+
+    uintptr_t oldOfs;
+    size_t oldLen, outLen;
+    MDS_BOOT_Digest_t ctx;
+} g_bootDelta;
+
+/* Function ---------------------------------------------------------------- */
+static int BOOT_DeltaFlush(struct BOOT_Delta *delta)
+{
+    if (delta->outLen == 0) {
+        return (0);
+    }
+
+    int res = MDS_BOOT_UpgradeWrite(delta->stage, sizeof(MDS_BOOT_DeltaInfo_t) + delta->newPos - delta->outLen,
+                                    g_deltaOutBuff, delta->outLen);
+    if (res == 0) {
+        res = MDS_BOOT_DigestUpdate(&(delta->ctx), g_deltaOutBuff, delta->outLen);
+        delta->outLen = 0;
+    }
+
+    return (res);
+}
+
+static size_t BOOT_DeltaHead(struct BOOT_Delta *delta, uint8_t *head, size_t headSize, const uint8_t *buff,
+                             size_t size)
+{
+    size_t len = ((headSize - delta->headLen) > size) ? (size) : (headSize - delta->headLen);
+
+    memcpy(head + delta->headLen, buff, len);
+    delta->headLen += len;
+
+    return (len);
+}
+
+static MDS_BOOT_Result_t BOOT_DeltaInfo(struct BOOT_Delta *delta)
+{
+    delta->oldSize = ALGO_GetU32BE(delta->info.oldSize);
+    delta->newSize = ALGO_GetU32BE(delta->info.newSize);
+    delta->headLen = 0;
+    delta->state = BOOT_DELTA_STATE_CTRL;
+
+    // the stage keeps the info in front of the patched image for a resumed commit
+    if (MDS_BOOT_UpgradeWrite(delta->stage, 0, (uint8_t *)(&(delta->info)), sizeof(delta->info)) != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_DeltaCtrl(struct BOOT_Delta *delta)
+{
+    delta->diffLen = ALGO_GetU32BE(&(delta->ctrl[0]));
+    delta->extraLen = ALGO_GetU32BE(&(delta->ctrl[sizeof(uint32_t)]));
+    delta->seek = (int32_t)ALGO_GetU32BE(&(delta->ctrl[sizeof(uint32_t) + sizeof(uint32_t)]));
+    delta->headLen = 0;
+
+    if ((delta->diffLen > (delta->newSize - delta->newPos)) ||
+        (delta->extraLen > (delta->newSize - delta->newPos - delta->diffLen)) ||
+        (delta->diffLen > (delta->oldSize - delta->oldPos))) {
+        return (MDS_BOOT_RESULT_EDELTA);
+    }
+
+    delta->state = BOOT_DELTA_STATE_DIFF;
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_DeltaDiff(struct BOOT_Delta *delta, const uint8_t *buff, size_t *size)
+{
+    // keep a window of the installed image around the patch cursor
+    if ((delta->oldPos < delta->oldOfs) || (delta->oldPos >= (delta->oldOfs + delta->oldLen))) {
+        delta->oldOfs = delta->oldPos;
+        delta->oldLen = ((delta->oldSize - delta->oldPos) > MDS_BOOT_DELTA_SIZE) ? (MDS_BOOT_DELTA_SIZE)
+                                                                                     : (delta->oldSize - delta->oldPos);
+        if (MDS_BOOT_DeviceRead(delta->base, delta->oldOfs, g_deltaOldBuff, delta->oldLen) != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+    }
+
+    size_t len = (*size > delta->diffLen) ? (delta->diffLen) : (*size);
+    len = (len > (delta->oldOfs + delta->oldLen - delta->oldPos)) ? (delta->oldOfs + delta->oldLen - delta->oldPos)
+                                                                  : (len);
+    len = (len > (MDS_BOOT_DELTA_SIZE - delta->outLen)) ? (MDS_BOOT_DELTA_SIZE - delta->outLen) : (len);
+
+    const uint8_t *old = &(g_deltaOldBuff[delta->oldPos - delta->oldOfs]);
+    for (size_t i = 0; i < len; i++) {
+        g_deltaOutBuff[delta->outLen + i] = buff[i] + old[i];
+    }
+
+    delta->outLen += len;
+    delta->oldPos += len;
+    delta->newPos += len;
+    delta->diffLen -= len;
+    *size = len;
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_DeltaExtra(struct BOOT_Delta *delta, const uint8_t *buff, size_t *size)
+{
+    size_t len = (*size > delta->extraLen) ? (delta->extraLen) : (*size);
+    len = (len > (MDS_BOOT_DELTA_SIZE - delta->outLen)) ? (MDS_BOOT_DELTA_SIZE - delta->outLen) : (len);
+
+    memcpy(&(g_deltaOutBuff[delta->outLen]), buff, len);
+
+    delta->outLen += len;
+    delta->newPos += len;
+    delta->extraLen -= len;
+    *size = len;
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_DeltaSeek(struct BOOT_Delta *delta)
+{
+    int64_t oldPos = (int64_t)(delta->oldPos) + delta->seek;
+
+    if ((oldPos < 0) || (oldPos > (int64_t)(delta->oldSize))) {
+        return (MDS_BOOT_RESULT_EDELTA);
+    }
+
+    delta->oldPos = (uint32_t)oldPos;
+    delta->state = BOOT_DELTA_STATE_CTRL;
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static int BOOT_DeltaPatch(void *arg, uintptr_t ofs, const uint8_t *buff, size_t size)
+{
+    struct BOOT_Delta *delta = (struct BOOT_Delta *)(arg);
+    MDS_BOOT_Result_t result = MDS_BOOT_RESULT_SUCCESS;
+
+    (void)(ofs);
+
+    while ((size > 0) && (result == MDS_BOOT_RESULT_SUCCESS)) {
+        size_t len = size;
+
+        switch (delta->state) {
+            case BOOT_DELTA_STATE_INFO:
+                len = BOOT_DeltaHead(delta, (uint8_t *)(&(delta->info)), sizeof(delta->info), buff, size);
+                if (delta->headLen == sizeof(delta->info)) {
+                    result = BOOT_DeltaInfo(delta);
+                }
+                break;
+            case BOOT_DELTA_STATE_CTRL:
+                len = BOOT_DeltaHead(delta, delta->ctrl, sizeof(delta->ctrl), buff, size);
+                if (delta->headLen == sizeof(delta->ctrl)) {
+                    result = BOOT_DeltaCtrl(delta);
+                }
+                break;
+            case BOOT_DELTA_STATE_DIFF:
+                result = BOOT_DeltaDiff(delta, buff, &len);
+                break;
+            case BOOT_DELTA_STATE_EXTRA:
+                result = BOOT_DeltaExtra(delta, buff, &len);
+                break;
+            default:
+                result = MDS_BOOT_RESULT_EDELTA;
+                break;
+        }
+
+        if ((result == MDS_BOOT_RESULT_SUCCESS) && (delta->outLen == MDS_BOOT_DELTA_SIZE)) {
+            result = (BOOT_DeltaFlush(delta) == 0) ? (MDS_BOOT_RESULT_SUCCESS) : (MDS_BOOT_RESULT_EIO);
+        }
+
+        // seek as soon as a record is done so the patch may end right behind it
+        if ((delta->state == BOOT_DELTA_STATE_DIFF) && (delta->diffLen == 0)) {
+            delta->state = BOOT_DELTA_STATE_EXTRA;
+        }
+        if ((result == MDS_BOOT_RESULT_SUCCESS) && (delta->state == BOOT_DELTA_STATE_EXTRA) &&
+            (delta->extraLen == 0)) {
+            result = BOOT_DeltaSeek(delta);
+        }
+
+        buff += len;
+        size -= len;
+    }
+
+    delta->result = result;
+
+    return ((result == MDS_BOOT_RESULT_SUCCESS) ? (0) : (-1));
+}
+
+static MDS_BOOT_Result_t BOOT_DeltaRaw(MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize,
+                                       MDS_BOOT_Output_t output, void *arg)
+{
+    for (uint32_t readOfs = 0; readOfs < srcSize;) {
+        size_t len = ((srcSize - readOfs) > MDS_BOOT_DELTA_SIZE) ? (MDS_BOOT_DELTA_SIZE)
+                                                                      : (srcSize - readOfs);
+
+        if (MDS_BOOT_UpgradeRead(src, srcOfs + readOfs, g_deltaReadBuff, len) != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        if (output(arg, readOfs, g_deltaReadBuff, len) != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        readOfs += len;
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_DeltaCommit(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *stage)
+{
+    MDS_BOOT_DeltaInfo_t info;
+
+    int res = MDS_BOOT_DeviceRead(stage, 0, (uint8_t *)(&info), sizeof(info));
+    if (res != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    res = MDS_BOOT_UpgradeErase(dst);
+    if (res != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    uint32_t size = ALGO_GetU32BE(info.newSize);
+    for (uint32_t ofs = MDS_BOOT_UpgradeResume(); ofs < size;) {
+        size_t len = ((size - ofs) > MDS_BOOT_DELTA_SIZE) ? (MDS_BOOT_DELTA_SIZE) : (size - ofs);
+
+        if (MDS_BOOT_DeviceRead(stage, sizeof(info) + ofs, g_deltaOutBuff, len) != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        if (MDS_BOOT_UpgradeWrite(dst, ofs, g_deltaOutBuff, len) != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        ofs += len;
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+// the raw patch is read through its own buffer, a compressed one through the lzma read buffers
+static MDS_BOOT_Result_t BOOT_DeltaAlloc(bool lzma)
+{
+    g_deltaReadBuff = (lzma) ? (NULL) : (MDS_BOOT_ArenaAlloc(MDS_BOOT_DELTA_SIZE));
+    g_deltaOldBuff = MDS_BOOT_ArenaAlloc(MDS_BOOT_DELTA_SIZE);
+    g_deltaOutBuff = MDS_BOOT_ArenaAlloc(MDS_BOOT_DELTA_SIZE);
+
+    if (((!lzma) && (g_deltaReadBuff == NULL)) || (g_deltaOldBuff == NULL) || (g_deltaOutBuff == NULL)) {
+        return (MDS_BOOT_RESULT_ENOMEM);
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_DeltaUpgrade(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                           uint32_t srcSize, bool lzma)
+{
+    struct BOOT_Delta *delta = &g_bootDelta;
+    MDS_BOOT_Device_t *stage = MDS_BOOT_GetStageDevice();
+    MDS_BOOT_Result_t result;
+    uint8_t digest[MDS_BOOT_CHKHASH_SIZE];
+
+    // the installed image is the patch base, never write it before the patched image is complete
+    if ((stage == NULL) || (stage == dst) || (stage == MDS_BOOT_UpgradeBase(dst))) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    // resumed after the patched image was verified, only the copy into place is left
+    if (MDS_BOOT_UpgradeGetPhase() == BOOT_DELTA_PHASE_COMMIT) {
+        if (MDS_BOOT_UpgradeSkip(src, srcOfs, srcSize) != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        return (BOOT_DeltaCommit(dst, stage));
+    }
+
+    memset(delta, 0, sizeof(*delta));
+    delta->base = MDS_BOOT_UpgradeBase(dst);
+    delta->stage = stage;
+    delta->state = BOOT_DELTA_STATE_INFO;
+
+    if ((MDS_BOOT_DigestInit(&(delta->ctx)) != 0) || (MDS_BOOT_UpgradeErase(stage) != 0)) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+    if (lzma) {
+        result = MDS_BOOT_LzmaDecode(src, srcOfs, srcSize, BOOT_DeltaPatch, delta);
+    } else
+#endif
+    {
+        (void)(lzma);
+        result = BOOT_DeltaRaw(src, srcOfs, srcSize, BOOT_DeltaPatch, delta);
+    }
+
+    if (delta->result != MDS_BOOT_RESULT_SUCCESS) {
+        return (delta->result);
+    } else if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
+    }
+
+    if ((delta->state != BOOT_DELTA_STATE_CTRL) || (delta->headLen != 0) || (delta->newPos != delta->newSize)) {
+        return (MDS_BOOT_RESULT_EDELTA);
+    }
+
+    if ((BOOT_DeltaFlush(delta) != 0) || (MDS_BOOT_UpgradeFlush() != 0)) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    if (MDS_BOOT_DigestFinish(&(delta->ctx), digest) != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+    if (memcmp(delta->info.hash, digest, sizeof(digest)) != 0) {
+        return (MDS_BOOT_RESULT_EVERIFY);
+    }
+
+    MDS_BOOT_UpgradeSetPhase(BOOT_DELTA_PHASE_COMMIT);
+
+    return (BOOT_DeltaCommit(dst, stage));
+}
+
+static MDS_BOOT_Result_t BOOT_DeltaEntry(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                         uint32_t srcSize, bool lzma)
+{
+    size_t mark = MDS_BOOT_ArenaMark();
+
+    MDS_BOOT_Result_t result = BOOT_DeltaAlloc(lzma);
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        result = BOOT_DeltaUpgrade(dst, src, srcOfs, srcSize, lzma);
+    }
+    MDS_BOOT_ArenaRelease(mark);
+
+    return (result);
+}
+
+MDS_BOOT_Result_t MDS_BOOT_UpgradeDelta(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                        uint32_t srcSize)
+{
+    return (BOOT_DeltaEntry(dst, src, srcOfs, srcSize, false));
+}
+
+MDS_BOOT_Result_t MDS_BOOT_UpgradeDeltaLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                            uint32_t srcSize)
+{
+    return (BOOT_DeltaEntry(dst, src, srcOfs, srcSize, true));
+}
+
+// take from the arena what the patch of the bin takes, the caller releases it
+MDS_BOOT_Result_t MDS_BOOT_ReserveDelta(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                        uint32_t srcSize)
+{
+    (void)(dst);
+    (void)(src);
+    (void)(srcOfs);
+    (void)(srcSize);
+
+    return (BOOT_DeltaAlloc(false));
+}
+
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+MDS_BOOT_Result_t MDS_BOOT_ReserveDeltaLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                            uint32_t srcSize)
+{
+    MDS_BOOT_Result_t result = BOOT_DeltaAlloc(true);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
+    }
+
+    // the patch is decompressed through a plain stream decoder, never into a mapped window
+    (void)(dst);
+
+    return (MDS_BOOT_ReserveLzma(NULL, src, srcOfs, srcSize));
+}
+#endif
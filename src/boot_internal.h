@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+#ifndef __BOOT_INTERNAL_H__
+#define __BOOT_INTERNAL_H__
+
+/* Include ----------------------------------------------------------------- */
+#include "mds_boot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Define ------------------------------------------------------------------ */
+// bracket a call into the device, the digest or a decoder, nothing is left of it without trace
+#if (MDS_BOOT_WITH_TRACE > 0)
+#define MDS_BOOT_TRACE_BEGIN()                 MDS_BOOT_TraceBegin()
+#define MDS_BOOT_TRACE_END(phase, begin, size) MDS_BOOT_TraceEnd((phase), (begin), (size))
+#else
+#define MDS_BOOT_TRACE_BEGIN()                 (0U)
+#define MDS_BOOT_TRACE_END(phase, begin, size) ((void)(begin))
+#endif
+
+#define MDS_BOOT_BUFF_NUM       ((MDS_BOOT_WITH_ASYNC > 0) ? (2) : (1))  // ping-pong buffers with async io
+#define MDS_BOOT_ARENA_ALIGN(x) (((x) + sizeof(uint64_t) - 1) & (~(sizeof(uint64_t) - 1)))
+
+/* Typedef ----------------------------------------------------------------- */
+typedef int (*MDS_BOOT_Output_t)(void *arg, uintptr_t ofs, const uint8_t *buff, size_t size);
+
+/* Function ---------------------------------------------------------------- */
+// engines reach the devices, the checkpoint and the arena of the upgrade in progress only through these
+extern int MDS_BOOT_UpgradeRead(MDS_BOOT_Device_t *src, uintptr_t ofs, uint8_t *buff, size_t size);
+extern const uint8_t *MDS_BOOT_UpgradeMap(MDS_BOOT_Device_t *src, uintptr_t ofs, size_t size);
+extern int MDS_BOOT_UpgradeReadSubmit(MDS_BOOT_Device_t *src, uintptr_t ofs, uint8_t *buff, size_t size);
+extern int MDS_BOOT_UpgradeReadWait(MDS_BOOT_Device_t *src);
+extern uint8_t *MDS_BOOT_UpgradeWindow(MDS_BOOT_Device_t *dst, uintptr_t ofs, size_t size);
+extern int MDS_BOOT_UpgradeWrite(MDS_BOOT_Device_t *dst, uintptr_t ofs, const uint8_t *buff, size_t size);
+extern int MDS_BOOT_UpgradeErase(MDS_BOOT_Device_t *dst);
+extern int MDS_BOOT_UpgradeFlush(void);
+extern int MDS_BOOT_UpgradeSkip(MDS_BOOT_Device_t *src, uintptr_t ofs, size_t size);
+extern uintptr_t MDS_BOOT_UpgradeResume(void);
+extern MDS_BOOT_Device_t *MDS_BOOT_UpgradeBase(MDS_BOOT_Device_t *dst);
+extern uint16_t MDS_BOOT_UpgradeGetPhase(void);
+extern void MDS_BOOT_UpgradeSetPhase(uint16_t phase);
+extern void *MDS_BOOT_ArenaAlloc(size_t size);
+extern size_t MDS_BOOT_ArenaMark(void);
+extern void MDS_BOOT_ArenaRelease(size_t mark);
+extern size_t MDS_BOOT_ArenaAvail(void);
+extern int MDS_BOOT_DigestInit(MDS_BOOT_Digest_t *ctx);
+extern int MDS_BOOT_DigestUpdate(MDS_BOOT_Digest_t *ctx, const uint8_t *data, size_t size);
+extern int MDS_BOOT_DigestSubmit(MDS_BOOT_Digest_t *ctx, const uint8_t *data, size_t size);
+extern int MDS_BOOT_DigestWait(MDS_BOOT_Digest_t *ctx);
+extern int MDS_BOOT_DigestFinish(MDS_BOOT_Digest_t *ctx, uint8_t hash[MDS_BOOT_CHKHASH_SIZE]);
+extern uint16_t MDS_BOOT_Crc16(uint16_t crc, const uint8_t *data, size_t size);
+extern uint32_t MDS_BOOT_TraceBegin(void);
+extern void MDS_BOOT_TraceEnd(uint16_t phase, uint32_t begin, size_t size);
+
+
+extern MDS_BOOT_Result_t MDS_BOOT_UpgradeCopy(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                              uint32_t srcSize);
+extern MDS_BOOT_Result_t MDS_BOOT_UpgradeLz4(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                             uint32_t srcSize);
+extern MDS_BOOT_Result_t MDS_BOOT_UpgradeLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                              uint32_t srcSize);
+extern MDS_BOOT_Result_t MDS_BOOT_UpgradeLzmaBlock(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                                   uint32_t srcSize);
+extern MDS_BOOT_Result_t MDS_BOOT_UpgradeDelta(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                               uint32_t srcSize);
+extern MDS_BOOT_Result_t MDS_BOOT_UpgradeDeltaLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                                   uint32_t srcSize);
+extern MDS_BOOT_Result_t MDS_BOOT_LzmaDecode(MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize,
+                                             MDS_BOOT_Output_t output, void *arg);
+extern MDS_BOOT_Result_t MDS_BOOT_Lz4Decode(MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize,
+                                            MDS_BOOT_Output_t output, void *arg);
+
+// take from the arena what the engine of the bin would take, without writing anything, the caller releases it
+extern MDS_BOOT_Result_t MDS_BOOT_ReserveLz4(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                             uint32_t srcSize);
+extern MDS_BOOT_Result_t MDS_BOOT_ReserveLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                              uint32_t srcSize);
+extern MDS_BOOT_Result_t MDS_BOOT_ReserveLzmaBlock(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                                   uint32_t srcSize);
+extern MDS_BOOT_Result_t MDS_BOOT_ReserveDelta(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                               uint32_t srcSize);
+extern MDS_BOOT_Result_t MDS_BOOT_ReserveDeltaLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                                   uint32_t srcSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_INTERNAL_H__ */
@@ -0,0 +1,310 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+/* Include ----------------------------------------------------------------- */
+#include "boot_internal.h"
+#include "algo_common.h"
+
+/* Define ------------------------------------------------------------------ */
+#define BOOT_LZ4_STORED    0x80000000U  // block size flag, the block is stored uncompressed
+#define BOOT_LZ4_MIN_MATCH 4
+#define BOOT_LZ4_RUN_MASK  0x0F
+
+/* Variable ---------------------------------------------------------------- */
+static uint8_t *g_lz4ReadBuff[MDS_BOOT_BUFF_NUM];
+static uint8_t *g_lz4BlockBuff = NULL;
+
+/* Function ---------------------------------------------------------------- */
+struct BOOT_Lz4Input {
+    MDS_BOOT_Device_t *src;
+    size_t ofs;   // source offset of the next chunk
+    size_t left;  // bytes of the block not fetched yet
+    const uint8_t *buff;
+    size_t pos;
+    size_t size;
+    size_t idx;      // read buffer filled next
+    size_t pending;  // size submitted ahead into the read buffer, 0 when none
+};
+
+// fetch the next chunk of the block, the one behind it is read while this one is decoded
+static int BOOT_Lz4Fill(struct BOOT_Lz4Input *in)
+{
+    if (in->left == 0) {
+        return (MDS_BOOT_RESULT_ELZ4);
+    }
+
+    // a mapped source is decoded in place as a single chunk
+    const uint8_t *data = (in->pending == 0) ? (MDS_BOOT_UpgradeMap(in->src, in->ofs, in->left)) : (NULL);
+    if (data != NULL) {
+        in->buff = data;
+        in->size = in->left;
+    } else {
+        size_t size = (in->left > MDS_BOOT_LZ4_READ_SIZE) ? (MDS_BOOT_LZ4_READ_SIZE) : (in->left);
+        size = (in->pending > 0) ? (in->pending) : (size);
+        if ((in->pending == 0) && (MDS_BOOT_UpgradeReadSubmit(in->src, in->ofs, g_lz4ReadBuff[in->idx], size) != 0)) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        in->pending = 0;
+        if (MDS_BOOT_UpgradeReadWait(in->src) != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        in->buff = g_lz4ReadBuff[in->idx];
+        in->size = size;
+        in->idx = (in->idx + 1) % MDS_BOOT_BUFF_NUM;
+    }
+
+    in->pos = 0;
+    in->ofs += in->size;
+    in->left -= in->size;
+
+    if ((MDS_BOOT_BUFF_NUM > 1) && (data == NULL) && (in->left > 0)) {
+        size_t next = (in->left > MDS_BOOT_LZ4_READ_SIZE) ? (MDS_BOOT_LZ4_READ_SIZE) : (in->left);
+        if (MDS_BOOT_UpgradeReadSubmit(in->src, in->ofs, g_lz4ReadBuff[in->idx], next) == 0) {
+            in->pending = next;
+        }
+    }
+
+    return (0);
+}
+
+static int BOOT_Lz4Byte(struct BOOT_Lz4Input *in, uint8_t *byte)
+{
+    if (in->pos == in->size) {
+        int res = BOOT_Lz4Fill(in);
+        if (res != 0) {
+            return (res);
+        }
+    }
+
+    *byte = in->buff[in->pos++];
+
+    return (0);
+}
+
+// length of a literal run or match, a nibble of 15 is extended by bytes until one is below 255
+static int BOOT_Lz4Length(struct BOOT_Lz4Input *in, size_t *len)
+{
+    uint8_t byte = UINT8_MAX;
+
+    if (*len != BOOT_LZ4_RUN_MASK) {
+        return (0);
+    }
+
+    while (byte == UINT8_MAX) {
+        int res = BOOT_Lz4Byte(in, &byte);
+        if (res != 0) {
+            return (res);
+        }
+        *len += byte;
+    }
+
+    return (0);
+}
+
+static int BOOT_Lz4Literal(struct BOOT_Lz4Input *in, uint8_t *out, size_t len)
+{
+    while (len > 0) {
+        if (in->pos == in->size) {
+            int res = BOOT_Lz4Fill(in);
+            if (res != 0) {
+                return (res);
+            }
+        }
+
+        size_t n = ((in->size - in->pos) > len) ? (len) : (in->size - in->pos);
+        memcpy(out, &(in->buff[in->pos]), n);
+        in->pos += n;
+        out += n;
+        len -= n;
+    }
+
+    return (0);
+}
+
+// decode one independent lz4 block, every match refers back into the block itself
+static MDS_BOOT_Result_t BOOT_Lz4Block(struct BOOT_Lz4Input *in, uint8_t *out, size_t outSize)
+{
+    size_t outPos = 0;
+
+    for (;;) {
+        uint8_t token, lo, hi;
+        if (BOOT_Lz4Byte(in, &token) != 0) {
+            return (MDS_BOOT_RESULT_ELZ4);
+        }
+
+        size_t len = token >> 4;
+        if ((BOOT_Lz4Length(in, &len) != 0) || (len > (outSize - outPos)) ||
+            (BOOT_Lz4Literal(in, &(out[outPos]), len) != 0)) {
+            return (MDS_BOOT_RESULT_ELZ4);
+        }
+        outPos += len;
+
+        // the last sequence of a block carries literals only
+        if ((in->pos == in->size) && (in->left == 0)) {
+            break;
+        }
+
+        if ((BOOT_Lz4Byte(in, &lo) != 0) || (BOOT_Lz4Byte(in, &hi) != 0)) {
+            return (MDS_BOOT_RESULT_ELZ4);
+        }
+
+        size_t offset = (size_t)(lo) | ((size_t)(hi) << __CHAR_BIT__);
+        len = token & BOOT_LZ4_RUN_MASK;
+        if ((offset == 0) || (offset > outPos) || (BOOT_Lz4Length(in, &len) != 0) ||
+            ((len + BOOT_LZ4_MIN_MATCH) > (outSize - outPos))) {
+            return (MDS_BOOT_RESULT_ELZ4);
+        }
+
+        // a match may overlap its own output, copy forward byte by byte
+        const uint8_t *match = &(out[outPos - offset]);
+        for (size_t i = 0; i < (len + BOOT_LZ4_MIN_MATCH); i++) {
+            out[outPos + i] = match[i];
+        }
+        outPos += len + BOOT_LZ4_MIN_MATCH;
+    }
+
+    return ((outPos == outSize) ? (MDS_BOOT_RESULT_SUCCESS) : (MDS_BOOT_RESULT_ELZ4));
+}
+
+static MDS_BOOT_Result_t BOOT_Lz4Open(MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize,
+                                      MDS_BOOT_Lz4Info_t *lz4Info)
+{
+    if (srcSize < sizeof(*lz4Info)) {
+        return (MDS_BOOT_RESULT_ELZ4);
+    }
+
+    if (MDS_BOOT_UpgradeRead(src, srcOfs, (uint8_t *)(lz4Info), sizeof(*lz4Info)) != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    if (ALGO_GetU32BE(lz4Info->blockSize) == 0) {
+        return (MDS_BOOT_RESULT_ELZ4);
+    }
+
+    for (size_t i = 0; i < MDS_BOOT_BUFF_NUM; i++) {
+        g_lz4ReadBuff[i] = MDS_BOOT_ArenaAlloc(MDS_BOOT_LZ4_READ_SIZE);
+        if (g_lz4ReadBuff[i] == NULL) {
+            return (MDS_BOOT_RESULT_ENOMEM);
+        }
+    }
+
+    g_lz4BlockBuff = MDS_BOOT_ArenaAlloc(ALGO_GetU32BE(lz4Info->blockSize));
+    if (g_lz4BlockBuff == NULL) {
+        return (MDS_BOOT_RESULT_ENOMEM);
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+// blocks that end before resumeOfs are not decoded
+static MDS_BOOT_Result_t BOOT_Lz4Decode(MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize,
+                                        const MDS_BOOT_Lz4Info_t *lz4Info, uintptr_t resumeOfs,
+                                        MDS_BOOT_Output_t output, void *arg)
+{
+    uint32_t blockSize = ALGO_GetU32BE(lz4Info->blockSize);
+    uint32_t unpackSize = ALGO_GetU32BE(lz4Info->unpackSize);
+    size_t endOfs = srcOfs + srcSize;
+
+    srcOfs += sizeof(*lz4Info);
+    for (uint32_t dstOfs = 0; dstOfs < unpackSize;) {
+        uint8_t head[sizeof(uint32_t)];
+
+        if (((endOfs - srcOfs) < sizeof(head)) || (MDS_BOOT_UpgradeRead(src, srcOfs, head, sizeof(head)) != 0)) {
+            return (((endOfs - srcOfs) < sizeof(head)) ? (MDS_BOOT_RESULT_ELZ4) : (MDS_BOOT_RESULT_EIO));
+        }
+
+        uint32_t size = ALGO_GetU32BE(head) & (~BOOT_LZ4_STORED);
+        uint32_t unpack = ((unpackSize - dstOfs) > blockSize) ? (blockSize) : (unpackSize - dstOfs);
+        srcOfs += sizeof(head);
+        if ((size == 0) || (size > (endOfs - srcOfs))) {
+            return (MDS_BOOT_RESULT_ELZ4);
+        }
+
+        MDS_BOOT_Result_t result = MDS_BOOT_RESULT_SUCCESS;
+        struct BOOT_Lz4Input in = {.src = src, .ofs = srcOfs, .left = size};
+        if ((dstOfs + unpack) <= resumeOfs) {
+            // blocks committed before the last power loss are only hashed
+            result = (MDS_BOOT_UpgradeSkip(src, srcOfs, size) == 0) ? (MDS_BOOT_RESULT_SUCCESS) : (MDS_BOOT_RESULT_EIO);
+        } else if ((ALGO_GetU32BE(head) & BOOT_LZ4_STORED) != 0) {
+            result = ((size == unpack) && (BOOT_Lz4Literal(&in, g_lz4BlockBuff, size) == 0))
+                         ? (MDS_BOOT_RESULT_SUCCESS)
+                         : (MDS_BOOT_RESULT_ELZ4);
+        } else {
+            result = BOOT_Lz4Block(&in, g_lz4BlockBuff, unpack);
+        }
+
+        // a block may end before the read submitted ahead is consumed
+        if ((in.pending > 0) && (MDS_BOOT_UpgradeReadWait(src) != 0) && (result == MDS_BOOT_RESULT_SUCCESS)) {
+            result = MDS_BOOT_RESULT_EIO;
+        }
+        if ((result == MDS_BOOT_RESULT_SUCCESS) && ((dstOfs + unpack) > resumeOfs) &&
+            (output(arg, dstOfs, g_lz4BlockBuff, unpack) != 0)) {
+            result = MDS_BOOT_RESULT_EIO;
+        }
+        if (result != MDS_BOOT_RESULT_SUCCESS) {
+            return (result);
+        }
+
+        srcOfs += size;
+        dstOfs += unpack;
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+MDS_BOOT_Result_t MDS_BOOT_Lz4Decode(MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize,
+                                     MDS_BOOT_Output_t output, void *arg)
+{
+    MDS_BOOT_Lz4Info_t lz4Info;
+    size_t mark = MDS_BOOT_ArenaMark();
+
+    MDS_BOOT_Result_t result = BOOT_Lz4Open(src, srcOfs, srcSize, &lz4Info);
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        result = BOOT_Lz4Decode(src, srcOfs, srcSize, &lz4Info, 0, output, arg);
+    }
+    MDS_BOOT_ArenaRelease(mark);
+
+    return (result);
+}
+
+static int BOOT_Lz4Write(void *arg, uintptr_t ofs, const uint8_t *buff, size_t size)
+{
+    return (MDS_BOOT_UpgradeWrite((MDS_BOOT_Device_t *)(arg), ofs, buff, size));
+}
+
+MDS_BOOT_Result_t MDS_BOOT_UpgradeLz4(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize)
+{
+    MDS_BOOT_Lz4Info_t lz4Info;
+    size_t mark = MDS_BOOT_ArenaMark();
+
+    MDS_BOOT_Result_t result = BOOT_Lz4Open(src, srcOfs, srcSize, &lz4Info);
+    if ((result == MDS_BOOT_RESULT_SUCCESS) && (MDS_BOOT_UpgradeErase(dst) != 0)) {
+        result = MDS_BOOT_RESULT_EIO;
+    }
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        result = BOOT_Lz4Decode(src, srcOfs, srcSize, &lz4Info, MDS_BOOT_UpgradeResume(), BOOT_Lz4Write, dst);
+    }
+    MDS_BOOT_ArenaRelease(mark);
+
+    return (result);
+}
+
+// take from the arena what the decoder of the bin takes, the caller releases it
+MDS_BOOT_Result_t MDS_BOOT_ReserveLz4(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize)
+{
+    MDS_BOOT_Lz4Info_t lz4Info;
+
+    (void)(dst);
+
+    return (BOOT_Lz4Open(src, srcOfs, srcSize, &lz4Info));
+}
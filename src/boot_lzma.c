@@ -10,135 +10,173 @@
  * See the Mulan PSL v2 for more details.
  **/
 /* Include ----------------------------------------------------------------- */
-#include "mds_boot.h"
+#include "boot_internal.h"
 #include "algo_common.h"
 #include "LzmaDec.h"
 
 /* Define ------------------------------------------------------------------ */
-#ifndef MDS_BOOT_LZMA_READ_SIZE
-#define MDS_BOOT_LZMA_READ_SIZE 1024
-#endif
-
-#ifndef MDS_BOOT_LZMA_WRITE_SIZE
-#define MDS_BOOT_LZMA_WRITE_SIZE 1024
-#endif
-
-#ifndef MDS_BOOT_LZMA_DICT_SIZE
-#define MDS_BOOT_LZMA_DICT_SIZE 4096
-#endif
-
-#ifndef MDS_BOOT_LZMA_PROBS_SIZE
-#define MDS_BOOT_LZMA_PROBS_SIZE 10112
-#endif
-
 #define BOOT_LZMA_HEADER_SIZE (LZMA_PROPS_SIZE + sizeof(uint64_t))
-#define BOOT_LZMA_ALIGN_SIZE  sizeof(size_t)
-#define BOOT_LZMA_ALIGN(x)    ((x + BOOT_LZMA_ALIGN_SIZE - 1) & (~(BOOT_LZMA_ALIGN_SIZE - (1ULL))))
 
 /* Variable ---------------------------------------------------------------- */
-static uint8_t g_lzmaReadBuff[BOOT_LZMA_ALIGN(MDS_BOOT_LZMA_READ_SIZE)];
-static uint8_t g_lzmaWriteBuff[BOOT_LZMA_ALIGN(MDS_BOOT_LZMA_WRITE_SIZE)];
+static uint8_t *g_lzmaReadBuff[MDS_BOOT_BUFF_NUM];
 
-static struct BOOT_LzmaDict {
-    bool used;
-    uint8_t buff[MDS_BOOT_LZMA_DICT_SIZE];
-} g_bootLzmaDict;
+// probs and dictionary come from the arena, so a dictionary is only bounded by what the arena has left
+static void *BOOT_LzmaAlloc(ISzAllocPtr p, size_t size)
+{
+    (void)(p);
 
-static struct BOOT_LzmaProbs {
-    bool used;
-    uint8_t buff[MDS_BOOT_LZMA_PROBS_SIZE];
-} g_bootLzmaProbs;
+    return (MDS_BOOT_ArenaAlloc(size));
+}
 
-static void *BOOT_LzmaAlloc(ISzAllocPtr p, size_t size)
+// released as a whole by the arena mark taken on entry
+static void BOOT_LzmaFree(ISzAllocPtr p, void *address)
 {
     (void)(p);
+    (void)(address);
+}
 
-    if ((size <= sizeof(g_bootLzmaProbs.buff)) && (!g_bootLzmaProbs.used)) {
-        g_bootLzmaProbs.used = true;
-        return (g_bootLzmaProbs.buff);
-    }
+static const ISzAlloc G_LZMA_ALLOC = {BOOT_LzmaAlloc, BOOT_LzmaFree};
 
-    if ((size <= sizeof(g_bootLzmaDict.buff)) && (!g_bootLzmaDict.used)) {
-        g_bootLzmaDict.used = true;
-        return (g_bootLzmaDict.buff);
+/* Function ---------------------------------------------------------------- */
+static bool BOOT_LzmaReadAlloc(void)
+{
+    for (size_t i = 0; i < MDS_BOOT_BUFF_NUM; i++) {
+        g_lzmaReadBuff[i] = MDS_BOOT_ArenaAlloc(MDS_BOOT_LZMA_READ_SIZE);
+        if (g_lzmaReadBuff[i] == NULL) {
+            return (false);
+        }
     }
 
-    return (NULL);
+    return (true);
 }
 
-static void BOOT_LzmaFree(ISzAllocPtr p, void *address)
+struct BOOT_LzmaInput {
+    size_t idx;      // read buffer decoded next
+    size_t pending;  // size submitted ahead into the read buffer, 0 when none
+};
+
+struct BOOT_LzmaBlockOutput {
+    MDS_BOOT_Device_t *dst;
+    uint16_t check;
+};
+
+static int BOOT_LzmaWrite(void *arg, uintptr_t ofs, const uint8_t *buff, size_t size)
 {
-    (void)(p);
+    return (MDS_BOOT_UpgradeWrite((MDS_BOOT_Device_t *)(arg), ofs, buff, size));
+}
 
-    if (address == g_bootLzmaProbs.buff) {
-        g_bootLzmaProbs.used = false;
-    } else if (address == g_bootLzmaDict.buff) {
-        g_bootLzmaDict.used = false;
-    }
+static int BOOT_LzmaBlockWrite(void *arg, uintptr_t ofs, const uint8_t *buff, size_t size)
+{
+    struct BOOT_LzmaBlockOutput *output = (struct BOOT_LzmaBlockOutput *)(arg);
+
+    output->check = MDS_BOOT_Crc16(output->check, buff, size);
+
+    return (MDS_BOOT_UpgradeWrite(output->dst, ofs, buff, size));
 }
 
-static const ISzAlloc G_LZMA_ALLOC = {BOOT_LzmaAlloc, BOOT_LzmaFree};
+// decode the current read buffer while the next one is filled
+static int BOOT_LzmaRead(MDS_BOOT_Device_t *src, size_t srcOfs, size_t srcSize, struct BOOT_LzmaInput *input,
+                         const uint8_t **inBuff, size_t *inSize)
+{
+    size_t size = (srcSize > MDS_BOOT_LZMA_READ_SIZE) ? (MDS_BOOT_LZMA_READ_SIZE) : (srcSize);
 
-/* Function ---------------------------------------------------------------- */
-static void BOOT_BuffMoveAligned(uint8_t *buff, size_t outPos, size_t wSize)
+    if ((input->pending == 0) && (MDS_BOOT_UpgradeReadSubmit(src, srcOfs, g_lzmaReadBuff[input->idx], size) != 0)) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    input->pending = 0;
+    int res = MDS_BOOT_UpgradeReadWait(src);
+    if (res != 0) {
+        return (res);
+    }
+
+    *inBuff = g_lzmaReadBuff[input->idx];
+    *inSize = size;
+    input->idx = (input->idx + 1) % MDS_BOOT_BUFF_NUM;
+
+    if ((MDS_BOOT_BUFF_NUM > 1) && (srcSize > size)) {
+        size_t next = ((srcSize - size) > MDS_BOOT_LZMA_READ_SIZE) ? (MDS_BOOT_LZMA_READ_SIZE) : (srcSize - size);
+        res = MDS_BOOT_UpgradeReadSubmit(src, srcOfs + size, g_lzmaReadBuff[input->idx], next);
+        if (res == 0) {
+            input->pending = next;
+        }
+    }
+
+    return (res);
+}
+
+// hand the decoded part of the dictionary ring to the output, straight from the ring, restart the ring at its end
+static int BOOT_LzmaFlush(CLzmaDec *dec, size_t *outPos, size_t *wIndex, MDS_BOOT_Output_t output, void *arg)
 {
-    for (size_t i = 0; i < outPos; i++) {
-        buff[i] = buff[wSize + i];
+    size_t wSize = dec->dicPos - *outPos;
+
+    MDS_BOOT_LOG("[write] outPos:%u wIndex:%u wSize:%u", *outPos, *wIndex, wSize);
+    if ((wSize > 0) && (output(arg, *wIndex, dec->dic + *outPos, wSize) != 0)) {
+        return (MDS_BOOT_RESULT_EIO);
     }
+
+    *wIndex += wSize;
+    *outPos = dec->dicPos;
+    if (dec->dicPos == dec->dicBufSize) {
+        dec->dicPos = 0;
+        *outPos = 0;
+    }
+
+    return (0);
 }
 
-static MDS_BOOT_Result_t BOOT_LzmaDecodeUpgrade(CLzmaDec *dec, MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src,
-                                                size_t srcOfs, size_t srcSize, uint64_t unpackSize)
+static MDS_BOOT_Result_t BOOT_LzmaDecodeStream(CLzmaDec *dec, MDS_BOOT_Device_t *src, size_t srcOfs, size_t srcSize,
+                                               size_t dstOfs, uint64_t unpackSize, MDS_BOOT_Output_t output,
+                                               void *arg, struct BOOT_LzmaInput *input)
 {
     bool thereIsSize = (unpackSize != __UINT64_MAX__);
-    size_t inPos = 0, inSize = 0, outPos = 0, wSize = 0, wIndex = 0, rIndex = 0;
+    size_t inPos = 0, inSize = 0, outPos = dec->dicPos, wIndex = dstOfs, rIndex = 0;
+    const uint8_t *inBuff = MDS_BOOT_UpgradeMap(src, srcOfs, srcSize);
+
+    // a mapped source is decoded in place as a single input buffer
+    if (inBuff != NULL) {
+        inSize = srcSize;
+        rIndex = srcSize;
+    }
 
     for (size_t cnt = 0;; cnt++) {
         if (inPos == inSize) {
-            inSize = ((srcSize - rIndex) > sizeof(g_lzmaReadBuff)) ? (sizeof(g_lzmaReadBuff)) : (srcSize - rIndex);
-            if (MDS_BOOT_DeviceRead(src, srcOfs + rIndex, g_lzmaReadBuff, inSize) != 0) {
+            if (BOOT_LzmaRead(src, srcOfs + rIndex, srcSize - rIndex, input, &inBuff, &inSize) != 0) {
                 return (MDS_BOOT_RESULT_EIO);
             }
             rIndex += inSize;
             inPos = 0;
         }
 
-        size_t inProcessed = inSize - inPos, outProcessed = sizeof(g_lzmaWriteBuff) - outPos;
-        MDS_BOOT_LOG("[read] inSize:%u inPos:%u inProc:%u outPos:%u outProc:%u cnt:%u", inSize, inPos, inProcessed,
-                     inPos, outProcessed, cnt);
-
+        // the ring is only flushed when full, so every write but the last covers the whole dictionary
+        size_t dicPos = dec->dicPos, inProcessed = inSize - inPos, dicLimit = dec->dicBufSize;
         ELzmaFinishMode finishMode = LZMA_FINISH_ANY;
-        if (thereIsSize && (outProcessed > unpackSize)) {
-            outProcessed = (size_t)unpackSize;
+        if (thereIsSize && ((dicLimit - dicPos) >= unpackSize)) {
+            dicLimit = dicPos + (size_t)(unpackSize);
             finishMode = LZMA_FINISH_END;
         }
 
-        MDS_BOOT_LOG("[decode] before inPos:%u rIndex:%u inProc:%u wIndex:%u, outPos:%u outProc:%u", inPos, rIndex,
-                     inProcessed, wIndex, outPos, outProcessed);
+        MDS_BOOT_LOG("[decode] before inPos:%u rIndex:%u inProc:%u dicPos:%u dicLimit:%u cnt:%u", inPos, rIndex,
+                     inProcessed, dicPos, dicLimit, cnt);
         ELzmaStatus status;
-        SRes res = LzmaDec_DecodeToBuf(dec, g_lzmaWriteBuff + outPos, &outProcessed, g_lzmaReadBuff + inPos,
-                                       &inProcessed, finishMode, &status);
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        SRes res = LzmaDec_DecodeToDic(dec, dicLimit, inBuff + inPos, &inProcessed, finishMode, &status);
+        size_t outProcessed = dec->dicPos - dicPos;
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_DECODE, trace, outProcessed);
         MDS_BOOT_LOG("[decode] after res:%u status:%u inProc:%u outProc:%u", res, status, inProcessed, outProcessed);
         if (res != SZ_OK) {
             return (MDS_BOOT_RESULT_ELZMA | (res & 0xFF));
         }
 
         inPos += inProcessed;
-        outPos += outProcessed;
         unpackSize -= outProcessed;
-        wSize = outPos - (outPos % BOOT_LZMA_ALIGN_SIZE);
 
-        MDS_BOOT_LOG("[write] inPos:%u outPos:%u wIndex:%u wSize:%u", inPos, outPos, wIndex, wSize);
-        if (MDS_BOOT_DeviceWrite(dst, wIndex, g_lzmaWriteBuff, wSize) != 0) {
+        bool finish = (thereIsSize && (unpackSize == 0)) || ((inProcessed == 0) && (outProcessed == 0));
+        if ((finish || (dec->dicPos == dec->dicBufSize)) &&
+            (BOOT_LzmaFlush(dec, &outPos, &wIndex, output, arg) != 0)) {
             return (MDS_BOOT_RESULT_EIO);
         }
 
-        wIndex += wSize;
-        outPos = outPos % BOOT_LZMA_ALIGN_SIZE;
-        BOOT_BuffMoveAligned(g_lzmaWriteBuff, outPos, wSize);
-        MDS_BOOT_LOG("[loop] wIndex:%u outPos:%u thereIsSize:%u inProc:%u outProc:%u unpackSize:%llu", wIndex, outPos,
-                     thereIsSize, inProcessed, outProcessed, unpackSize);
-
         if (thereIsSize && (unpackSize == 0)) {
             return (MDS_BOOT_RESULT_SUCCESS);
         } else if ((inProcessed == 0) && (outProcessed == 0)) {
@@ -148,19 +186,203 @@ static MDS_BOOT_Result_t BOOT_LzmaDecodeUpgrade(CLzmaDec *dec, MDS_BOOT_Device_t
     }
 }
 
-MDS_BOOT_Result_t MDS_BOOT_UpgradeLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize)
+static MDS_BOOT_Result_t BOOT_LzmaDecodeUpgrade(CLzmaDec *dec, MDS_BOOT_Device_t *src, size_t srcOfs, size_t srcSize,
+                                                size_t dstOfs, uint64_t unpackSize, MDS_BOOT_Output_t output,
+                                                void *arg)
 {
-    uint8_t header[BOOT_LZMA_HEADER_SIZE];
-    uint64_t unpackSize = 0;
-    CLzmaDec dec;
+    struct BOOT_LzmaInput input = {0};
+
+    MDS_BOOT_Result_t result = BOOT_LzmaDecodeStream(dec, src, srcOfs, srcSize, dstOfs, unpackSize, output, arg,
+                                                     &input);
+
+    // the stream may end before the read submitted ahead is consumed
+    if ((input.pending > 0) && (MDS_BOOT_UpgradeReadWait(src) != 0) && (result == MDS_BOOT_RESULT_SUCCESS)) {
+        result = MDS_BOOT_RESULT_EIO;
+    }
+
+    return (result);
+}
+
+// decode straight into a mapped destination, the window itself serves as the dictionary
+static MDS_BOOT_Result_t BOOT_LzmaDecodeWindow(CLzmaDec *dec, MDS_BOOT_Device_t *src, size_t srcOfs, size_t srcSize,
+                                               size_t unpackSize)
+{
+    struct BOOT_LzmaInput input = {0};
+    MDS_BOOT_Result_t result = MDS_BOOT_RESULT_SUCCESS;
+    size_t inPos = 0, inSize = 0, rIndex = 0;
+    const uint8_t *inBuff = MDS_BOOT_UpgradeMap(src, srcOfs, srcSize);
+
+    if (inBuff != NULL) {
+        inSize = srcSize;
+        rIndex = srcSize;
+    }
+
+    while (dec->dicPos < unpackSize) {
+        if (inPos == inSize) {
+            if ((rIndex == srcSize) ||
+                (BOOT_LzmaRead(src, srcOfs + rIndex, srcSize - rIndex, &input, &inBuff, &inSize) != 0)) {
+                result = (rIndex == srcSize) ? (MDS_BOOT_RESULT_ELZMA) : (MDS_BOOT_RESULT_EIO);
+                break;
+            }
+            rIndex += inSize;
+            inPos = 0;
+        }
+
+        size_t dicPos = dec->dicPos, inProcessed = inSize - inPos;
+        ELzmaStatus status;
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        SRes res = LzmaDec_DecodeToDic(dec, unpackSize, inBuff + inPos, &inProcessed, LZMA_FINISH_END, &status);
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_DECODE, trace, dec->dicPos - dicPos);
+        if (res != SZ_OK) {
+            result = MDS_BOOT_RESULT_ELZMA | (res & 0xFF);
+            break;
+        }
+
+        inPos += inProcessed;
+        if ((inProcessed == 0) && (dec->dicPos == dicPos)) {
+            result = MDS_BOOT_RESULT_ELZMA;
+            break;
+        }
+    }
+
+    if ((input.pending > 0) && (MDS_BOOT_UpgradeReadWait(src) != 0) && (result == MDS_BOOT_RESULT_SUCCESS)) {
+        result = MDS_BOOT_RESULT_EIO;
+    }
+
+    return (result);
+}
+
+static MDS_BOOT_Result_t BOOT_LzmaHeader(MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize,
+                                         uint8_t header[BOOT_LZMA_HEADER_SIZE])
+{
+    if (srcSize < BOOT_LZMA_HEADER_SIZE) {
+        return (MDS_BOOT_RESULT_ELZMA);
+    }
 
-    int res = MDS_BOOT_DeviceRead(src, srcOfs, header, sizeof(header));
+    int res = MDS_BOOT_UpgradeRead(src, srcOfs, header, BOOT_LZMA_HEADER_SIZE);
     if (res != 0) {
         return (MDS_BOOT_RESULT_EIO);
     }
 
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_LzmaOpen(CLzmaDec *dec, MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize,
+                                       uint64_t *unpackSize, MDS_BOOT_Device_t *dst, uint8_t **window)
+{
+    uint8_t header[BOOT_LZMA_HEADER_SIZE];
+
+    MDS_BOOT_Result_t result = BOOT_LzmaHeader(src, srcOfs, srcSize, header);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
+    }
+
+    *unpackSize = 0;
     for (uint8_t i = 0; i < (BOOT_LZMA_HEADER_SIZE - LZMA_PROPS_SIZE); i++) {
-        unpackSize += ((uint64_t)header[LZMA_PROPS_SIZE + i]) << (i * __CHAR_BIT__);
+        *unpackSize += ((uint64_t)header[LZMA_PROPS_SIZE + i]) << (i * __CHAR_BIT__);
+    }
+
+    LzmaDec_Construct(dec);
+    *window = NULL;
+    if (!BOOT_LzmaReadAlloc()) {
+        return (MDS_BOOT_RESULT_ENOMEM);
+    }
+
+    if ((dst != NULL) && (*unpackSize != __UINT64_MAX__)) {
+        *window = MDS_BOOT_UpgradeWindow(dst, 0, (size_t)(*unpackSize));
+    }
+
+    if (*window != NULL) {
+        if (LzmaDec_AllocateProbs(dec, header, LZMA_PROPS_SIZE, &G_LZMA_ALLOC) != SZ_OK) {
+            return (MDS_BOOT_RESULT_ENOMEM);
+        }
+        dec->dic = *window;
+        dec->dicBufSize = (size_t)(*unpackSize);
+    } else if (LzmaDec_Allocate(dec, header, LZMA_PROPS_SIZE, &G_LZMA_ALLOC) != SZ_OK) {
+        return (MDS_BOOT_RESULT_ENOMEM);
+    }
+
+    LzmaDec_Init(dec);
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static void BOOT_LzmaClose(CLzmaDec *dec, uint8_t *window)
+{
+    if (window != NULL) {
+        LzmaDec_FreeProbs(dec, &G_LZMA_ALLOC);
+        dec->dic = NULL;
+    } else {
+        LzmaDec_Free(dec, &G_LZMA_ALLOC);
+    }
+}
+
+MDS_BOOT_Result_t MDS_BOOT_LzmaDecode(MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize,
+                                      MDS_BOOT_Output_t output, void *arg)
+{
+    uint64_t unpackSize;
+    uint8_t *window;
+    CLzmaDec dec;
+    size_t mark = MDS_BOOT_ArenaMark();
+
+    MDS_BOOT_Result_t result = BOOT_LzmaOpen(&dec, src, srcOfs, srcSize, &unpackSize, NULL, &window);
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        result = BOOT_LzmaDecodeUpgrade(&dec, src, srcOfs + BOOT_LZMA_HEADER_SIZE, srcSize - BOOT_LZMA_HEADER_SIZE,
+                                        0, unpackSize, output, arg);
+        BOOT_LzmaClose(&dec, window);
+    }
+    MDS_BOOT_ArenaRelease(mark);
+
+    return (result);
+}
+
+MDS_BOOT_Result_t MDS_BOOT_UpgradeLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize)
+{
+    uint64_t unpackSize;
+    uint8_t *window;
+    CLzmaDec dec;
+    size_t mark = MDS_BOOT_ArenaMark();
+
+    MDS_BOOT_Result_t result = BOOT_LzmaOpen(&dec, src, srcOfs, srcSize, &unpackSize, dst, &window);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        MDS_BOOT_ArenaRelease(mark);
+        return (result);
+    }
+
+    if (MDS_BOOT_UpgradeErase(dst) != 0) {
+        result = MDS_BOOT_RESULT_EIO;
+    } else if (window != NULL) {
+        result = BOOT_LzmaDecodeWindow(&dec, src, srcOfs + BOOT_LZMA_HEADER_SIZE, srcSize - BOOT_LZMA_HEADER_SIZE,
+                                       (size_t)(unpackSize));
+    } else {
+        result = BOOT_LzmaDecodeUpgrade(&dec, src, srcOfs + BOOT_LZMA_HEADER_SIZE, srcSize - BOOT_LZMA_HEADER_SIZE,
+                                        0, unpackSize, BOOT_LzmaWrite, dst);
+    }
+    BOOT_LzmaClose(&dec, window);
+    MDS_BOOT_ArenaRelease(mark);
+
+    return (result);
+}
+
+// take from the arena what the decoder of the bin takes with a dictionary of its own, the caller releases it,
+// no window is set up, a bin later decoded into a mapped dst takes less than this
+MDS_BOOT_Result_t MDS_BOOT_ReserveLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                       uint32_t srcSize)
+{
+    uint8_t header[BOOT_LZMA_HEADER_SIZE];
+    CLzmaDec dec;
+
+    (void)(dst);
+
+    MDS_BOOT_Result_t result = BOOT_LzmaHeader(src, srcOfs, srcSize, header);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
+    }
+
+    for (size_t i = 0; i < MDS_BOOT_BUFF_NUM; i++) {
+        if (MDS_BOOT_ArenaAlloc(MDS_BOOT_LZMA_READ_SIZE) == NULL) {
+            return (MDS_BOOT_RESULT_ENOMEM);
+        }
     }
 
     LzmaDec_Construct(&dec);
@@ -168,14 +390,152 @@ MDS_BOOT_Result_t MDS_BOOT_UpgradeLzma(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t
         return (MDS_BOOT_RESULT_ENOMEM);
     }
 
-    res = MDS_BOOT_DeviceErase(dst);
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_LzmaBlockTable(MDS_BOOT_Device_t *src, size_t tableOfs, uint16_t count, size_t dataSize)
+{
+    size_t dataOfs = 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+        MDS_BOOT_BlockEntry_t entry;
+
+        if (MDS_BOOT_UpgradeRead(src, tableOfs + (i * sizeof(entry)), (uint8_t *)(&entry), sizeof(entry)) != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        uint32_t ofs = ALGO_GetU32BE(entry.ofs);
+        uint32_t size = ALGO_GetU32BE(entry.size);
+        if ((ofs != dataOfs) || (size > (dataSize - dataOfs))) {
+            return (MDS_BOOT_RESULT_ELZMA);
+        }
+
+        dataOfs += size;
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+// check the block header and table, then take a decoder sized for a single block
+static MDS_BOOT_Result_t BOOT_LzmaBlockOpen(CLzmaDec *dec, MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t srcSize,
+                                            MDS_BOOT_BlockInfo_t *blockInfo)
+{
+    if (srcSize < sizeof(*blockInfo)) {
+        return (MDS_BOOT_RESULT_ELZMA);
+    }
+
+    int res = MDS_BOOT_UpgradeRead(src, srcOfs, (uint8_t *)(blockInfo), sizeof(*blockInfo));
     if (res != 0) {
         return (MDS_BOOT_RESULT_EIO);
     }
 
-    LzmaDec_Init(&dec);
-    MDS_BOOT_Result_t result = BOOT_LzmaDecodeUpgrade(&dec, dst, src, srcOfs + sizeof(header), srcSize, unpackSize);
-    LzmaDec_Free(&dec, &G_LZMA_ALLOC);
+    uint16_t count = ALGO_GetU16BE(blockInfo->count);
+    uint32_t blockSize = ALGO_GetU32BE(blockInfo->blockSize);
+    uint32_t unpackSize = ALGO_GetU32BE(blockInfo->unpackSize);
+    size_t tableOfs = srcOfs + sizeof(*blockInfo);
+    size_t dataOfs = tableOfs + (count * sizeof(MDS_BOOT_BlockEntry_t));
+    if ((blockSize == 0) || (dataOfs > (srcOfs + srcSize)) ||
+        (count != ((unpackSize / blockSize) + (((unpackSize % blockSize) != 0) ? (1) : (0))))) {
+        return (MDS_BOOT_RESULT_ELZMA);
+    }
+
+    MDS_BOOT_Result_t result = BOOT_LzmaBlockTable(src, tableOfs, count, srcOfs + srcSize - dataOfs);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
+    }
+
+    // a block never looks back past its own start, so its dictionary is capped by the block size
+    uint32_t dictSize = 0;
+    for (uint8_t i = 0; i < sizeof(uint32_t); i++) {
+        dictSize |= ((uint32_t)(blockInfo->props[1 + i])) << (i * __CHAR_BIT__);
+    }
+    if (dictSize > blockSize) {
+        for (uint8_t i = 0; i < sizeof(uint32_t); i++) {
+            blockInfo->props[1 + i] = (uint8_t)(blockSize >> (i * __CHAR_BIT__));
+        }
+    }
+
+    LzmaDec_Construct(dec);
+    if ((!BOOT_LzmaReadAlloc()) || (LzmaDec_Allocate(dec, blockInfo->props, LZMA_PROPS_SIZE, &G_LZMA_ALLOC) != SZ_OK)) {
+        return (MDS_BOOT_RESULT_ENOMEM);
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_LzmaBlockUpgrade(CLzmaDec *dec, MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src,
+                                               uint32_t srcOfs, const MDS_BOOT_BlockInfo_t *blockInfo)
+{
+    MDS_BOOT_Result_t result = MDS_BOOT_RESULT_SUCCESS;
+    uint16_t count = ALGO_GetU16BE(blockInfo->count);
+    uint32_t blockSize = ALGO_GetU32BE(blockInfo->blockSize);
+    uint32_t unpackSize = ALGO_GetU32BE(blockInfo->unpackSize);
+    size_t tableOfs = srcOfs + sizeof(*blockInfo);
+    size_t dataOfs = tableOfs + (count * sizeof(MDS_BOOT_BlockEntry_t));
+
+    if (MDS_BOOT_UpgradeErase(dst) != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    uintptr_t resumeOfs = MDS_BOOT_UpgradeResume();
+    for (uint16_t i = 0; (i < count) && (result == MDS_BOOT_RESULT_SUCCESS); i++) {
+        MDS_BOOT_BlockEntry_t entry;
+
+        if (MDS_BOOT_UpgradeRead(src, tableOfs + (i * sizeof(entry)), (uint8_t *)(&entry), sizeof(entry)) != 0) {
+            result = MDS_BOOT_RESULT_EIO;
+            break;
+        }
+
+        uint32_t ofs = ALGO_GetU32BE(entry.ofs);
+        uint32_t size = ALGO_GetU32BE(entry.size);
+        uint16_t check = ALGO_GetU16BE(entry.check);
+        size_t dstOfs = (size_t)(i) * blockSize;
+        size_t unpack = ((unpackSize - dstOfs) > blockSize) ? (blockSize) : (unpackSize - dstOfs);
+
+        // restart at the block holding the checkpoint, only blocks wholly committed before it are taken as in place,
+        // the writes of the restarted block below it are dropped
+        if ((dstOfs + unpack) <= resumeOfs) {
+            if (MDS_BOOT_UpgradeSkip(src, dataOfs + ofs, size) != 0) {
+                result = MDS_BOOT_RESULT_EIO;
+            }
+            continue;
+        }
+
+        struct BOOT_LzmaBlockOutput output = {.dst = dst, .check = 0};
+        LzmaDec_Init(dec);
+        result = BOOT_LzmaDecodeUpgrade(dec, src, dataOfs + ofs, size, dstOfs, unpack, BOOT_LzmaBlockWrite, &output);
+        if ((result == MDS_BOOT_RESULT_SUCCESS) && (output.check != check)) {
+            result = MDS_BOOT_RESULT_ELZMA;
+        }
+    }
 
     return (result);
 }
+
+MDS_BOOT_Result_t MDS_BOOT_UpgradeLzmaBlock(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                            uint32_t srcSize)
+{
+    MDS_BOOT_BlockInfo_t blockInfo;
+    CLzmaDec dec;
+    size_t mark = MDS_BOOT_ArenaMark();
+
+    MDS_BOOT_Result_t result = BOOT_LzmaBlockOpen(&dec, src, srcOfs, srcSize, &blockInfo);
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        result = BOOT_LzmaBlockUpgrade(&dec, dst, src, srcOfs, &blockInfo);
+        LzmaDec_Free(&dec, &G_LZMA_ALLOC);
+    }
+    MDS_BOOT_ArenaRelease(mark);
+
+    return (result);
+}
+
+MDS_BOOT_Result_t MDS_BOOT_ReserveLzmaBlock(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                            uint32_t srcSize)
+{
+    MDS_BOOT_BlockInfo_t blockInfo;
+    CLzmaDec dec;
+
+    (void)(dst);
+
+    return (BOOT_LzmaBlockOpen(&dec, src, srcOfs, srcSize, &blockInfo));
+}
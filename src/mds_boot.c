@@ -10,265 +10,2834 @@
  * See the Mulan PSL v2 for more details.
  **/
 /* Include ----------------------------------------------------------------- */
-#include "mds_boot.h"
+#include "boot_internal.h"
 #include "algo_crc.h"
 #include "algo_sha2.h"
 
+#if (defined(MDS_BOOT_WITH_STATIC) && (MDS_BOOT_WITH_STATIC > 0) && defined(MDS_BOOT_STATIC_HEADER))
+#include MDS_BOOT_STATIC_HEADER
+#endif
+
 /* Define ------------------------------------------------------------------ */
 #ifndef MDS_BOOT_UPGRADE_RETRY
 #define MDS_BOOT_UPGRADE_RETRY 3
 #endif
 
-#ifndef MDS_BOOT_CHECK_SIZE
-#define MDS_BOOT_CHECK_SIZE 1024
+#ifndef MDS_BOOT_CHECKPOINT_SIZE
+#define MDS_BOOT_CHECKPOINT_SIZE 4096
+#endif
+
+#ifndef MDS_BOOT_WITH_FUSED
+#define MDS_BOOT_WITH_FUSED 0
+#endif
+
+#ifndef MDS_BOOT_VERIFY_RETRY
+#define MDS_BOOT_VERIFY_RETRY 2  // programs of a page again after its read back differed, with ops reprogram
+#endif
+
+#if (defined(MDS_BOOT_WITH_STATIC) && (MDS_BOOT_WITH_STATIC > 0))
+// the static header may bind these to inline functions or macros of the flash driver instead
+#ifndef MDS_BOOT_STATIC_READ
+#define MDS_BOOT_STATIC_READ(dev, ofs, buff, size) MDS_BOOT_StaticRead(dev, ofs, buff, size)
+#endif
+
+#ifndef MDS_BOOT_STATIC_WRITE
+#define MDS_BOOT_STATIC_WRITE(dev, ofs, buff, size) MDS_BOOT_StaticWrite(dev, ofs, buff, size)
+#endif
+
+#ifndef MDS_BOOT_STATIC_ERASE
+#define MDS_BOOT_STATIC_ERASE(dev) MDS_BOOT_StaticErase(dev)
+#endif
+
+#ifndef MDS_BOOT_STATIC_ERASE_SECTOR
+#define MDS_BOOT_STATIC_ERASE_SECTOR(dev, ofs, size) MDS_BOOT_StaticEraseSector(dev, ofs, size)
+#endif
+
+#define BOOT_DEVICE_STATIC(dev) ((dev)->ops == NULL)
+#else
+#define BOOT_DEVICE_STATIC(dev) (false)
+#endif
+
+#define MDS_BOOT_SECTOR_BLANK 0xFF
+
+// the software sha256 runs in the state of a digest, raise MDS_BOOT_DIGEST_SIZE when it does not fit
+#define BOOT_DIGEST_ALGO(ctx) ((ALGO_SHA256_Context_t *)((ctx)->state))
+typedef char BOOT_DigestFits_t[(sizeof(ALGO_SHA256_Context_t) <= MDS_BOOT_DIGEST_SIZE) ? (1) : (-1)];
+
+#define BOOT_ARENA_MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define BOOT_ARENA_CHECK     (MDS_BOOT_BUFF_NUM * MDS_BOOT_ARENA_ALIGN(MDS_BOOT_CHECK_SIZE))
+#define BOOT_ARENA_PAGE      ((MDS_BOOT_BUFF_NUM * MDS_BOOT_ARENA_ALIGN(MDS_BOOT_PAGE_SIZE)) + BOOT_ARENA_BACK)
+#define BOOT_ARENA_SKIP      MDS_BOOT_ARENA_ALIGN(MDS_BOOT_CHKHASH_SIZE)  // smallest chunk skipped under a decoder
+
+#if (defined(MDS_BOOT_WITH_VERIFY) && (MDS_BOOT_WITH_VERIFY > 0))
+#define BOOT_ARENA_BACK MDS_BOOT_ARENA_ALIGN(MDS_BOOT_PAGE_SIZE)
+#else
+#define BOOT_ARENA_BACK 0
+#endif
+
+#if (defined(MDS_BOOT_WITH_COMPARE) && (MDS_BOOT_WITH_COMPARE > 0))
+#define BOOT_ARENA_SECTOR MDS_BOOT_ARENA_ALIGN(MDS_BOOT_SECTOR_SIZE)
+#else
+#define BOOT_ARENA_SECTOR 0
+#endif
+
+#if (defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0))
+#define BOOT_ARENA_LZ4                                                                                                 \
+    ((MDS_BOOT_BUFF_NUM * MDS_BOOT_ARENA_ALIGN(MDS_BOOT_LZ4_READ_SIZE)) +                                              \
+     MDS_BOOT_ARENA_ALIGN(MDS_BOOT_LZ4_BLOCK_SIZE) + BOOT_ARENA_SKIP)
+#else
+#define BOOT_ARENA_LZ4 0
+#endif
+
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+#define BOOT_ARENA_LZMA                                                                                                \
+    ((MDS_BOOT_BUFF_NUM * MDS_BOOT_ARENA_ALIGN(MDS_BOOT_LZMA_READ_SIZE)) +                                             \
+     MDS_BOOT_ARENA_ALIGN(MDS_BOOT_LZMA_DICT_SIZE) + MDS_BOOT_ARENA_ALIGN(MDS_BOOT_LZMA_PROBS_SIZE) + BOOT_ARENA_SKIP)
+#else
+#define BOOT_ARENA_LZMA 0
+#endif
+
+#if (defined(MDS_BOOT_WITH_DELTA) && (MDS_BOOT_WITH_DELTA > 0))
+#define BOOT_ARENA_DELTA ((3 * MDS_BOOT_ARENA_ALIGN(MDS_BOOT_DELTA_SIZE)) + BOOT_ARENA_LZMA + BOOT_ARENA_SKIP)
+#else
+#define BOOT_ARENA_DELTA 0
+#endif
+
+// page and sector buffers of the bin under the largest of hashing or copy and the engines, which never overlap
+#ifndef MDS_BOOT_ARENA_SIZE
+#define MDS_BOOT_ARENA_SIZE                                                                                            \
+    (BOOT_ARENA_PAGE + BOOT_ARENA_SECTOR + BOOT_ARENA_MAX(BOOT_ARENA_MAX(BOOT_ARENA_CHECK, BOOT_ARENA_LZ4),            \
+                                                          BOOT_ARENA_MAX(BOOT_ARENA_LZMA, BOOT_ARENA_DELTA)))
+#endif
+
+/* Variable ---------------------------------------------------------------- */
+static __attribute__((used, section(MDS_BOOT_SWAP_SECTION))) struct BOOT_SwapSection {
+    MDS_BOOT_SwapInfo_t swapInfo;
+#if (MDS_BOOT_WITH_TRACE > 0)
+    MDS_BOOT_TraceInfo_t traceInfo;  // extension behind the swap info, checked on its own
+#endif
+} g_bootSwapSection;
+static MDS_BOOT_UpgradeInfo_t g_bootUpgradeInfo = {0};
+static const MDS_BOOT_UpgradeOps_t *g_bootUpgradeOps = NULL;
+static MDS_BOOT_Device_t *g_bootStageDevice = NULL;
+static const MDS_BOOT_Partition_t *g_bootPartitionTable = NULL;
+static uint16_t g_bootPartitionCount = 0;
+static const MDS_BOOT_Codec_t *g_bootCodecTable = NULL;
+static uint16_t g_bootCodecCount = 0;
+static const MDS_BOOT_DigestOps_t *g_bootDigestOps = NULL;
+static MDS_BOOT_Device_t g_bootBinDevice;
+
+static struct BOOT_UpgradeDigest {
+    bool active;
+    int res;  // first failure of the provider, the digests are unusable after it
+    uintptr_t ofs;
+    MDS_BOOT_Digest_t total;
+    MDS_BOOT_Digest_t bin;
+} g_bootUpgradeDigest;
+
+static struct BOOT_UpgradeCheckpoint {
+    MDS_BOOT_SwapInfo_t *swapInfo;
+    uint16_t phase;
+    uintptr_t resumeOfs;
+    uintptr_t syncOfs;
+    uintptr_t dstOfs;
+    size_t budget;  // bytes a step writes before it yields at a commit, 0 never yields
+    size_t spent;
+    bool yield;     // the step committed its budget, writes are refused until it returns
+    bool mismatch;  // a page read back differed, the io error the codec makes of it is reported as EVERIFY
+} g_bootUpgradeCheckpoint;
+
+static MDS_BOOT_UpgradeStat_t g_bootUpgradeStat;
+
+static struct BOOT_UpgradeStream {
+    const MDS_BOOT_Stream_t *stream;
+    uintptr_t pos;  // package bytes pulled so far
+    MDS_BOOT_Device_t device;
+} g_bootUpgradeStream;
+
+static struct BOOT_UpgradeExtent {
+    MDS_BOOT_Device_t *dev;   // destination of the install
+    MDS_BOOT_Device_t *base;  // installed image a delta bin to dev is patched from
+    uintptr_t size;           // end of the furthest write to dev
+#if (defined(MDS_BOOT_WITH_VERIFY) && (MDS_BOOT_WITH_VERIFY > 0))
+    bool follow;     // every verified byte of dev so far landed in order from its start
+    uintptr_t ofs;   // the image digest covers dev up to here
+    MDS_BOOT_Digest_t image;
+#endif
+} g_bootUpgradeExtent;
+
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+static const MDS_BOOT_CryptOps_t *g_bootCryptOps = NULL;
+
+static struct BOOT_UpgradeCrypt {
+    MDS_BOOT_Device_t *src;  // NULL outside an encrypted bin
+    uintptr_t ofs;           // source offset of the first encrypted byte
+    uintptr_t end;
+    uint8_t iv[MDS_BOOT_CRYPT_BLOCK];
+} g_bootUpgradeCrypt;
+#endif
+
+#if (MDS_BOOT_WITH_TRACE > 0)
+static struct BOOT_UpgradeTrace {
+    MDS_BOOT_Tick_t tick;
+    bool active;  // phases are only counted inside the upgrade check
+    uint32_t begin;
+} g_bootUpgradeTrace;
+#endif
+
+// every working buffer is taken from here and released in reverse order
+static struct BOOT_UpgradeArena {
+    size_t used;
+    size_t peak;
+    uint64_t buff[(MDS_BOOT_ARENA_SIZE + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+} g_bootUpgradeArena;
+
+static __attribute__((used)) const MDS_BOOT_ArenaReport_t g_bootArenaReport = {
+    .check = BOOT_ARENA_CHECK,
+    .page = BOOT_ARENA_PAGE,
+    .sector = BOOT_ARENA_SECTOR,
+    .lz4 = BOOT_ARENA_LZ4,
+    .lzma = BOOT_ARENA_LZMA,
+    .delta = BOOT_ARENA_DELTA,
+    .size = sizeof(g_bootUpgradeArena.buff),
+};
+
+static struct BOOT_UpgradePage {
+    uint8_t *buff[MDS_BOOT_BUFF_NUM];
+    uint8_t *back;           // read back buffer of programmed pages, NULL without verify
+    size_t size;             // page buffer size of the bin, 0 programs straight from the caller
+    MDS_BOOT_Device_t *dev;  // device of the buffered page, NULL when empty
+    uintptr_t base;
+    size_t idx;  // page buffer being filled, the other one may still be programming
+    size_t lo;  // span buffered within the page
+    size_t hi;
+} g_bootUpgradePage;
+
+static struct BOOT_UpgradeRead {
+    MDS_BOOT_Device_t *dev;  // device of the submitted read, NULL when idle
+    uintptr_t ofs;
+    uint8_t *buff;
+    size_t size;
+    int res;  // result of a read already done synchronously
+    bool async;
+} g_bootUpgradeRead;
+
+static struct BOOT_UpgradeProgram {
+    MDS_BOOT_Device_t *dev;  // device of the submitted program, NULL when idle
+    uintptr_t end;           // checkpoint offset once the program is done
+    uintptr_t ofs;           // range read back once the program is done
+    const uint8_t *buff;
+    size_t size;
+} g_bootUpgradeProgram;
+
+static struct BOOT_UpgradeErase {
+    MDS_BOOT_Device_t *dev;  // device erased lazily, NULL when erased up front
+    uintptr_t ofs;           // erased from the start of the bin up to this offset
+} g_bootUpgradeErase;
+
+#if (defined(MDS_BOOT_WITH_COMPARE) && (MDS_BOOT_WITH_COMPARE > 0))
+static struct BOOT_UpgradeSector {
+    uint8_t *buff;
+    size_t size;             // sector buffer size of the bin, 0 disables compare
+    MDS_BOOT_Device_t *dev;  // device of the buffered sector, NULL when empty
+    uintptr_t base;
+    size_t lo;  // span written by the upgrade within the sector
+    size_t hi;
+    bool dirty;
+    bool erase;
+} g_bootUpgradeSector;
+#endif
+
+/* Function ---------------------------------------------------------------- */
+void *MDS_BOOT_ArenaAlloc(size_t size)
+{
+    struct BOOT_UpgradeArena *arena = &g_bootUpgradeArena;
+
+    size = MDS_BOOT_ARENA_ALIGN(size);
+    if (size > (sizeof(arena->buff) - arena->used)) {
+        return (NULL);
+    }
+
+    void *ptr = (uint8_t *)(arena->buff) + arena->used;
+    arena->used += size;
+    arena->peak = (arena->used > arena->peak) ? (arena->used) : (arena->peak);
+
+    return (ptr);
+}
+
+size_t MDS_BOOT_ArenaMark(void)
+{
+    return (g_bootUpgradeArena.used);
+}
+
+// free everything allocated since the mark
+void MDS_BOOT_ArenaRelease(size_t mark)
+{
+    if (mark < g_bootUpgradeArena.used) {
+        g_bootUpgradeArena.used = mark;
+    }
+}
+
+size_t MDS_BOOT_ArenaAvail(void)
+{
+    return (sizeof(g_bootUpgradeArena.buff) - g_bootUpgradeArena.used);
+}
+
+const MDS_BOOT_ArenaReport_t *MDS_BOOT_GetArenaReport(void)
+{
+    return (&g_bootArenaReport);
+}
+
+static bool BOOT_CheckBuffAlloc(uint8_t *buff[MDS_BOOT_BUFF_NUM])
+{
+    for (size_t i = 0; i < MDS_BOOT_BUFF_NUM; i++) {
+        buff[i] = MDS_BOOT_ArenaAlloc(MDS_BOOT_CHECK_SIZE);
+        if (buff[i] == NULL) {
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+static const MDS_BOOT_UpgradeOps_t *BOOT_DeviceOps(const MDS_BOOT_Device_t *dev)
+{
+    if ((dev != NULL) && (dev->ops != NULL)) {
+        return (dev->ops);
+    }
+
+    return (g_bootUpgradeOps);
+}
+
+// a device with a size is a region, accesses past its end are refused
+static bool BOOT_DeviceRange(const MDS_BOOT_Device_t *dev, uintptr_t ofs, size_t size)
+{
+    return ((dev->size == 0) || ((ofs <= dev->size) && (size <= (dev->size - ofs))));
+}
+
+// the static driver serves a device without ops of its own, and erases by sectors like any flash driver
+static bool BOOT_DeviceEraseSectorable(const MDS_BOOT_Device_t *dev)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+    return ((BOOT_DEVICE_STATIC(dev)) || ((ops != NULL) && (ops->eraseSector != NULL)));
+}
+
+int MDS_BOOT_DeviceRead(MDS_BOOT_Device_t *dev, uintptr_t ofs, uint8_t *buff, size_t size)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+#if (defined(MDS_BOOT_WITH_STATIC) && (MDS_BOOT_WITH_STATIC > 0))
+    if ((BOOT_DEVICE_STATIC(dev)) && (BOOT_DeviceRange(dev, ofs, size))) {
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        int res = MDS_BOOT_STATIC_READ(dev, dev->ofs + ofs, buff, size);
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_READ, trace, size);
+        return (res);
+    }
+#endif
+
+    if ((ops != NULL) && (ops->read != NULL) && (BOOT_DeviceRange(dev, ofs, size))) {
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        int res = ops->read(dev, dev->ofs + ofs, buff, size);
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_READ, trace, size);
+        return (res);
+    }
+
+    return (MDS_BOOT_RESULT_EIO);
+}
+
+int MDS_BOOT_DeviceWrite(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *buff, size_t size)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+#if (defined(MDS_BOOT_WITH_STATIC) && (MDS_BOOT_WITH_STATIC > 0))
+    if ((BOOT_DEVICE_STATIC(dev)) && (BOOT_DeviceRange(dev, ofs, size))) {
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        int res = MDS_BOOT_STATIC_WRITE(dev, dev->ofs + ofs, buff, size);
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_WRITE, trace, size);
+        return (res);
+    }
+#endif
+
+    if ((ops != NULL) && (ops->write != NULL) && (BOOT_DeviceRange(dev, ofs, size))) {
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        int res = ops->write(dev, dev->ofs + ofs, buff, size);
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_WRITE, trace, size);
+        return (res);
+    }
+
+    return (MDS_BOOT_RESULT_EIO);
+}
+
+int MDS_BOOT_DeviceEraseSector(MDS_BOOT_Device_t *dev, uintptr_t ofs, size_t size)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+#if (defined(MDS_BOOT_WITH_STATIC) && (MDS_BOOT_WITH_STATIC > 0))
+    if ((BOOT_DEVICE_STATIC(dev)) && (BOOT_DeviceRange(dev, ofs, size))) {
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        int res = MDS_BOOT_STATIC_ERASE_SECTOR(dev, dev->ofs + ofs, size);
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_ERASE, trace, size);
+        return (res);
+    }
+#endif
+
+    if ((ops != NULL) && (ops->eraseSector != NULL) && (BOOT_DeviceRange(dev, ofs, size))) {
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        int res = ops->eraseSector(dev, dev->ofs + ofs, size);
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_ERASE, trace, size);
+        return (res);
+    }
+
+    return (MDS_BOOT_RESULT_EIO);
+}
+
+// a region is erased by sectors, never the whole device it shares with other regions
+int MDS_BOOT_DeviceErase(MDS_BOOT_Device_t *dev)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+    if (dev->size > 0) {
+        return (MDS_BOOT_DeviceEraseSector(dev, 0, dev->size));
+    }
+
+#if (defined(MDS_BOOT_WITH_STATIC) && (MDS_BOOT_WITH_STATIC > 0))
+    if (BOOT_DEVICE_STATIC(dev)) {
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        int res = MDS_BOOT_STATIC_ERASE(dev);
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_ERASE, trace, 0);
+        return (res);
+    }
+#endif
+
+    if ((ops != NULL) && (ops->erase != NULL)) {
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        int res = ops->erase(dev);
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_ERASE, trace, 0);
+        return (res);
+    }
+
+    return (MDS_BOOT_RESULT_EIO);
+}
+
+void *MDS_BOOT_DeviceMap(MDS_BOOT_Device_t *dev, uintptr_t ofs, size_t size, bool write)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+    if ((ops != NULL) && (ops->map != NULL) && (BOOT_DeviceRange(dev, ofs, size))) {
+        return (ops->map(dev, dev->ofs + ofs, size, write));
+    }
+
+    return (NULL);
+}
+
+int MDS_BOOT_DeviceWait(MDS_BOOT_Device_t *dev)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+    if ((ops != NULL) && (ops->wait != NULL)) {
+        return (ops->wait(dev));
+    }
+
+    return (0);
+}
+
+static bool BOOT_AsyncRead(const MDS_BOOT_Device_t *dev)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+    return ((MDS_BOOT_WITH_ASYNC > 0) && (ops != NULL) && (ops->readSubmit != NULL) && (ops->wait != NULL));
+}
+
+static bool BOOT_AsyncWrite(const MDS_BOOT_Device_t *dev)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+    return ((MDS_BOOT_WITH_ASYNC > 0) && (ops != NULL) && (ops->writeSubmit != NULL) && (ops->wait != NULL));
+}
+
+static int BOOT_DeviceReadSubmit(MDS_BOOT_Device_t *dev, uintptr_t ofs, uint8_t *buff, size_t size)
+{
+    if (!BOOT_DeviceRange(dev, ofs, size)) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+    int res = BOOT_DeviceOps(dev)->readSubmit(dev, dev->ofs + ofs, buff, size);
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_READ, trace, size);
+
+    return (res);
+}
+
+static int BOOT_DeviceWriteSubmit(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *buff, size_t size)
+{
+    if (!BOOT_DeviceRange(dev, ofs, size)) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+    int res = BOOT_DeviceOps(dev)->writeSubmit(dev, dev->ofs + ofs, buff, size);
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_WRITE, trace, size);
+
+    return (res);
+}
+
+// the registered provider when it hashes, else the software sha256 of mds_component_algo
+static const MDS_BOOT_DigestOps_t *BOOT_DigestOps(void)
+{
+    const MDS_BOOT_DigestOps_t *ops = g_bootDigestOps;
+
+    if ((ops != NULL) && (ops->init != NULL) && (ops->update != NULL) && (ops->finish != NULL)) {
+        return (ops);
+    }
+
+    return (NULL);
+}
+
+int MDS_BOOT_DigestInit(MDS_BOOT_Digest_t *ctx)
+{
+    const MDS_BOOT_DigestOps_t *ops = BOOT_DigestOps();
+
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+    int res = 0;
+
+    if (ops != NULL) {
+        res = ops->init(ctx);
+    } else {
+        ALGO_SHA256_Init(BOOT_DIGEST_ALGO(ctx));
+    }
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_HASH, trace, 0);
+
+    return (res);
+}
+
+int MDS_BOOT_DigestUpdate(MDS_BOOT_Digest_t *ctx, const uint8_t *data, size_t size)
+{
+    const MDS_BOOT_DigestOps_t *ops = BOOT_DigestOps();
+
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+    int res = 0;
+
+    if (ops != NULL) {
+        res = ops->update(ctx, data, size);
+    } else {
+        ALGO_SHA256_Update(BOOT_DIGEST_ALGO(ctx), data, size);
+    }
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_HASH, trace, size);
+
+    return (res);
+}
+
+// synchronous fallback, data is hashed before the submit returns
+int MDS_BOOT_DigestSubmit(MDS_BOOT_Digest_t *ctx, const uint8_t *data, size_t size)
+{
+    const MDS_BOOT_DigestOps_t *ops = BOOT_DigestOps();
+
+    if ((ops == NULL) || (ops->updateSubmit == NULL) || (ops->wait == NULL)) {
+        return (MDS_BOOT_DigestUpdate(ctx, data, size));
+    }
+
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+    int res = ops->updateSubmit(ctx, data, size);
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_HASH, trace, size);
+
+    return (res);
+}
+
+int MDS_BOOT_DigestWait(MDS_BOOT_Digest_t *ctx)
+{
+    const MDS_BOOT_DigestOps_t *ops = BOOT_DigestOps();
+
+    if ((ops == NULL) || (ops->updateSubmit == NULL) || (ops->wait == NULL)) {
+        return (0);
+    }
+
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+    int res = ops->wait(ctx);
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_HASH, trace, 0);
+
+    return (res);
+}
+
+int MDS_BOOT_DigestFinish(MDS_BOOT_Digest_t *ctx, uint8_t hash[MDS_BOOT_CHKHASH_SIZE])
+{
+    const MDS_BOOT_DigestOps_t *ops = BOOT_DigestOps();
+    ALGO_SHA256_Digest_t digest;
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+    int res = 0;
+
+    if (ops != NULL) {
+        res = ops->finish(ctx, hash);
+    } else {
+        ALGO_SHA256_Finish(BOOT_DIGEST_ALGO(ctx), &digest);
+        memcpy(hash, digest.hash, MDS_BOOT_CHKHASH_SIZE);
+    }
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_HASH, trace, 0);
+
+    return (res);
+}
+
+uint16_t MDS_BOOT_Crc16(uint16_t crc, const uint8_t *data, size_t size)
+{
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+
+    if ((g_bootDigestOps != NULL) && (g_bootDigestOps->crc16 != NULL)) {
+        crc = g_bootDigestOps->crc16(crc, data, size);
+    } else {
+        crc = ALGO_CRC16(crc, data, size);
+    }
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_CHECK, trace, size);
+
+    return (crc);
+}
+
+#if (MDS_BOOT_WITH_TRACE > 0)
+uint32_t MDS_BOOT_TraceBegin(void)
+{
+    struct BOOT_UpgradeTrace *trace = &g_bootUpgradeTrace;
+
+    return ((trace->tick != NULL) ? (trace->tick()) : (0));
+}
+
+void MDS_BOOT_TraceEnd(uint16_t phase, uint32_t begin, size_t size)
+{
+    struct BOOT_UpgradeTrace *trace = &g_bootUpgradeTrace;
+
+    if ((!trace->active) || (phase >= MDS_BOOT_TRACE_NUM)) {
+        return;
+    }
+
+    MDS_BOOT_TraceStat_t *stat = &(g_bootSwapSection.traceInfo.phase[phase]);
+    stat->calls += 1;
+    stat->bytes += (uint32_t)(size);
+    stat->ticks += MDS_BOOT_TraceBegin() - begin;
+}
+
+static void BOOT_TraceOpen(void)
+{
+    struct BOOT_UpgradeTrace *trace = &g_bootUpgradeTrace;
+    MDS_BOOT_TraceInfo_t *traceInfo = &(g_bootSwapSection.traceInfo);
+
+    memset(traceInfo, 0, sizeof(*traceInfo));
+    traceInfo->version = MDS_BOOT_TRACE_VERSION;
+    traceInfo->size = sizeof(*traceInfo);
+    traceInfo->count = MDS_BOOT_TRACE_NUM;
+    trace->begin = MDS_BOOT_TraceBegin();
+    trace->active = true;
+}
+
+// the check is taken without a phase, nothing is counted once it is sealed
+static void BOOT_TraceClose(MDS_BOOT_Result_t result)
+{
+    struct BOOT_UpgradeTrace *trace = &g_bootUpgradeTrace;
+    MDS_BOOT_TraceInfo_t *traceInfo = &(g_bootSwapSection.traceInfo);
+
+    trace->active = false;
+    traceInfo->result = result;
+    traceInfo->ticks = MDS_BOOT_TraceBegin() - trace->begin;
+    traceInfo->check =
+        MDS_BOOT_Crc16(0, (uint8_t *)(&(traceInfo->version)), sizeof(*traceInfo) - sizeof(traceInfo->check));
+}
+
+#endif
+
+void MDS_BOOT_SetTickHook(MDS_BOOT_Tick_t tick)
+{
+#if (MDS_BOOT_WITH_TRACE > 0)
+    g_bootUpgradeTrace.tick = tick;
+#else
+    (void)(tick);
+#endif
+}
+
+// NULL while no trace passes its check, always so without trace
+const MDS_BOOT_TraceInfo_t *MDS_BOOT_GetTraceInfo(void)
+{
+#if (MDS_BOOT_WITH_TRACE > 0)
+    const MDS_BOOT_TraceInfo_t *traceInfo = &(g_bootSwapSection.traceInfo);
+
+    if ((traceInfo->version != MDS_BOOT_TRACE_VERSION) || (traceInfo->size != sizeof(*traceInfo)) ||
+        (traceInfo->check !=
+         MDS_BOOT_Crc16(0, (uint8_t *)(&(traceInfo->version)), sizeof(*traceInfo) - sizeof(traceInfo->check)))) {
+        return (NULL);
+    }
+
+    return (traceInfo);
+#else
+    return (NULL);
+#endif
+}
+
+// fused digest only sees every payload byte once and in order
+static int BOOT_DigestCheck(uintptr_t ofs, size_t size, bool *update)
+{
+    struct BOOT_UpgradeDigest *digest = &g_bootUpgradeDigest;
+
+    *update = false;
+    if ((!digest->active) || ((ofs + size) <= digest->ofs)) {
+        return (0);
+    } else if (ofs != digest->ofs) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    *update = true;
+
+    return (0);
+}
+
+static void BOOT_DigestUpdate(const uint8_t *buff, size_t size)
+{
+    struct BOOT_UpgradeDigest *digest = &g_bootUpgradeDigest;
+
+    if (digest->res == 0) {
+        digest->res = MDS_BOOT_DigestUpdate(&(digest->total), buff, size);
+    }
+    if (digest->res == 0) {
+        digest->res = MDS_BOOT_DigestUpdate(&(digest->bin), buff, size);
+    }
+    digest->ofs += size;
+}
+
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+static void BOOT_CryptCounter(const uint8_t iv[MDS_BOOT_CRYPT_BLOCK], uintptr_t block,
+                              uint8_t counter[MDS_BOOT_CRYPT_BLOCK])
+{
+    uint32_t carry = 0;
+
+    for (size_t i = MDS_BOOT_CRYPT_BLOCK; i > 0; i--) {
+        carry += (uint32_t)(iv[i - 1]) + (uint32_t)(block & 0xFF);
+        counter[i - 1] = (uint8_t)(carry);
+        carry >>= 0x08;
+        block >>= 0x08;
+    }
+}
+
+static int BOOT_CryptStream(uint8_t counter[MDS_BOOT_CRYPT_BLOCK], uint8_t *data, size_t len)
+{
+    const MDS_BOOT_CryptOps_t *ops = g_bootCryptOps;
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+    int res = 0;
+
+    if (ops->ctr != NULL) {
+        res = ops->ctr(counter, data, len);
+    } else {
+        MDS_BOOT_CryptCtr(ops->key, counter, data, len);
+    }
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_CRYPT, trace, len);
+
+    BOOT_CryptCounter(counter, (len + MDS_BOOT_CRYPT_BLOCK - 1) / MDS_BOOT_CRYPT_BLOCK, counter);
+
+    return (res);
+}
+
+static bool BOOT_CryptRange(const MDS_BOOT_Device_t *src, uintptr_t ofs, size_t size)
+{
+    const struct BOOT_UpgradeCrypt *crypt = &g_bootUpgradeCrypt;
+
+    return ((crypt->src != NULL) && (crypt->src == src) && (ofs < crypt->end) && ((ofs + size) > crypt->ofs));
+}
+
+// decrypt in place the part of a read inside the encrypted bin, after the digest has taken the ciphertext
+static int BOOT_CryptApply(const MDS_BOOT_Device_t *src, uintptr_t ofs, uint8_t *buff, size_t size)
+{
+    struct BOOT_UpgradeCrypt *crypt = &g_bootUpgradeCrypt;
+    uint8_t counter[MDS_BOOT_CRYPT_BLOCK];
+    uint8_t stream[MDS_BOOT_CRYPT_BLOCK];
+    int res = 0;
+
+    if (!BOOT_CryptRange(src, ofs, size)) {
+        return (0);
+    }
+
+    if (ofs < crypt->ofs) {
+        buff += crypt->ofs - ofs;
+        size -= crypt->ofs - ofs;
+        ofs = crypt->ofs;
+    }
+    size = ((ofs + size) > crypt->end) ? (crypt->end - ofs) : (size);
+
+    uintptr_t pos = ofs - crypt->ofs;
+    BOOT_CryptCounter(crypt->iv, pos / MDS_BOOT_CRYPT_BLOCK, counter);
+
+    // a chunk boundary inside a block takes the keystream of the whole block, the engine only runs whole blocks
+    for (size_t head = pos % MDS_BOOT_CRYPT_BLOCK; (res == 0) && (size > 0);) {
+        size_t len = size - (size % MDS_BOOT_CRYPT_BLOCK);
+        if ((head == 0) && (len > 0)) {
+            res = BOOT_CryptStream(counter, buff, len);
+        } else {
+            len = ((MDS_BOOT_CRYPT_BLOCK - head) > size) ? (size) : (MDS_BOOT_CRYPT_BLOCK - head);
+            memset(stream, 0, sizeof(stream));
+            res = BOOT_CryptStream(counter, stream, sizeof(stream));
+            for (size_t i = 0; i < len; i++) {
+                buff[i] ^= stream[head + i];
+            }
+        }
+        buff += len;
+        size -= len;
+        head = 0;
+    }
+
+    return ((res != 0) ? (MDS_BOOT_RESULT_EIO) : (0));
+}
+#else
+#define BOOT_CryptApply(src, ofs, buff, size) (0)
+#define BOOT_CryptRange(src, ofs, size)       (false)
+#endif
+
+int MDS_BOOT_UpgradeRead(MDS_BOOT_Device_t *src, uintptr_t ofs, uint8_t *buff, size_t size)
+{
+    bool update;
+    int res = BOOT_DigestCheck(ofs, size, &update);
+    if (res != 0) {
+        return (res);
+    }
+
+    res = MDS_BOOT_DeviceRead(src, ofs, buff, size);
+    if ((res == 0) && (update)) {
+        BOOT_DigestUpdate(buff, size);
+    }
+    if (res == 0) {
+        res = BOOT_CryptApply(src, ofs, buff, size);
+    }
+
+    return (res);
+}
+
+const uint8_t *MDS_BOOT_UpgradeMap(MDS_BOOT_Device_t *src, uintptr_t ofs, size_t size)
+{
+    // ciphertext is never handed out, the caller falls back to reads that decrypt
+    bool update;
+    if ((BOOT_CryptRange(src, ofs, size)) || (BOOT_DigestCheck(ofs, size, &update) != 0)) {
+        return (NULL);
+    }
+
+    const uint8_t *data = MDS_BOOT_DeviceMap(src, ofs, size, false);
+    if ((data != NULL) && (update)) {
+        BOOT_DigestUpdate(data, size);
+    }
+
+    return (data);
+}
+
+int MDS_BOOT_UpgradeReadSubmit(MDS_BOOT_Device_t *src, uintptr_t ofs, uint8_t *buff, size_t size)
+{
+    struct BOOT_UpgradeRead *read = &g_bootUpgradeRead;
+
+    if (read->dev != NULL) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    // synchronous fallback, the result is reported by the wait
+    if ((!BOOT_AsyncRead(src)) || (size == 0)) {
+        read->res = MDS_BOOT_UpgradeRead(src, ofs, buff, size);
+        read->async = false;
+        read->dev = src;
+        return (0);
+    }
+
+    bool update;
+    int res = BOOT_DigestCheck(ofs, size, &update);
+    if (res != 0) {
+        return (res);
+    }
+
+    res = BOOT_DeviceReadSubmit(src, ofs, buff, size);
+    if (res == 0) {
+        read->ofs = ofs;
+        read->buff = buff;
+        read->size = size;
+        read->async = true;
+        read->dev = src;
+    }
+
+    return (res);
+}
+
+int MDS_BOOT_UpgradeReadWait(MDS_BOOT_Device_t *src)
+{
+    struct BOOT_UpgradeRead *read = &g_bootUpgradeRead;
+
+    if (read->dev != src) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    read->dev = NULL;
+    if (!read->async) {
+        return (read->res);
+    }
+
+    bool update;
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+    int res = MDS_BOOT_DeviceWait(src);
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_READ, trace, 0);
+    if (res == 0) {
+        res = BOOT_DigestCheck(read->ofs, read->size, &update);
+    }
+    if ((res == 0) && (update)) {
+        BOOT_DigestUpdate(read->buff, read->size);
+    }
+    if (res == 0) {
+        res = BOOT_CryptApply(src, read->ofs, read->buff, read->size);
+    }
+
+    return (res);
+}
+
+int MDS_BOOT_UpgradeSkip(MDS_BOOT_Device_t *src, uintptr_t ofs, size_t size)
+{
+    struct BOOT_UpgradeDigest *digest = &g_bootUpgradeDigest;
+
+    // bytes no engine consumes still belong to the fused digest
+    if ((!digest->active) || ((ofs + size) <= digest->ofs)) {
+        return (0);
+    }
+
+    if (ofs < digest->ofs) {
+        size -= digest->ofs - ofs;
+        ofs = digest->ofs;
+    }
+
+    if (MDS_BOOT_UpgradeMap(src, ofs, size) != NULL) {
+        return (0);
+    }
+
+    // a decoder may hold most of the arena, skip through whatever is left of it
+    size_t mark = MDS_BOOT_ArenaMark();
+    size_t chunk = MDS_BOOT_ArenaAvail();
+    chunk = (chunk > MDS_BOOT_CHECK_SIZE) ? (MDS_BOOT_CHECK_SIZE) : (chunk);
+    uint8_t *buff = MDS_BOOT_ArenaAlloc(chunk);
+    int res = ((buff == NULL) || (chunk == 0)) ? (MDS_BOOT_RESULT_ENOMEM) : (0);
+
+    while ((res == 0) && (size > 0)) {
+        size_t len = (size > chunk) ? (chunk) : (size);
+        res = MDS_BOOT_UpgradeRead(src, ofs, buff, len);
+        ofs += len;
+        size -= len;
+    }
+    MDS_BOOT_ArenaRelease(mark);
+
+    return (res);
+}
+
+// magic sits behind padding, the check covers the record from it to its end and nothing beyond
+static uint16_t BOOT_SwapInfoCheck(const MDS_BOOT_SwapInfo_t *swapInfo)
+{
+    return (MDS_BOOT_Crc16(0, (const uint8_t *)(&(swapInfo->magic)),
+                           sizeof(*swapInfo) - offsetof(MDS_BOOT_SwapInfo_t, magic)));
+}
+
+static void BOOT_SwapInfoCommit(MDS_BOOT_SwapInfo_t *swapInfo)
+{
+    swapInfo->check = BOOT_SwapInfoCheck(swapInfo);
+
+    if ((g_bootUpgradeOps != NULL) && (g_bootUpgradeOps->sync != NULL)) {
+        uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+        g_bootUpgradeOps->sync(swapInfo);
+        MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_WRITE, trace, sizeof(*swapInfo));
+    }
+}
+
+static void BOOT_CheckpointCommit(void)
+{
+    struct BOOT_UpgradeCheckpoint *ckpt = &g_bootUpgradeCheckpoint;
+
+    ckpt->syncOfs = ckpt->dstOfs;
+    ckpt->yield = ((ckpt->budget > 0) && (ckpt->spent >= ckpt->budget));
+    if (ckpt->swapInfo != NULL) {
+        ckpt->swapInfo->checkpoint.phase = ckpt->phase;
+        ckpt->swapInfo->checkpoint.dstOfs = ckpt->dstOfs;
+        BOOT_SwapInfoCommit(ckpt->swapInfo);
+    }
+}
+
+static void BOOT_CheckpointWrite(uintptr_t ofs)
+{
+    struct BOOT_UpgradeCheckpoint *ckpt = &g_bootUpgradeCheckpoint;
+
+    ckpt->dstOfs = ofs;
+    if ((ckpt->dstOfs - ckpt->syncOfs) >= MDS_BOOT_CHECKPOINT_SIZE) {
+        BOOT_CheckpointCommit();
+    }
+}
+
+static size_t BOOT_SectorSize(const MDS_BOOT_Device_t *dev)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+    if ((ops != NULL) && (ops->sectorSize > 0)) {
+        return (ops->sectorSize);
+    }
+
+    return (MDS_BOOT_SECTOR_SIZE);
+}
+
+static bool BOOT_EraseLazy(const MDS_BOOT_Device_t *dev)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+    return ((BOOT_DeviceEraseSectorable(dev)) && (ops != NULL) && (ops->sectorSize > 0));
+}
+
+// erase whole sectors from the erase frontier up to the end of the next program
+static int BOOT_EraseAhead(MDS_BOOT_Device_t *dev, uintptr_t end)
+{
+    struct BOOT_UpgradeErase *erase = &g_bootUpgradeErase;
+
+    if ((erase->dev != dev) || (end <= erase->ofs)) {
+        return (0);
+    }
+
+    size_t sectorSize = BOOT_SectorSize(dev);
+    uintptr_t top = ((end + sectorSize - 1) / sectorSize) * sectorSize;
+    top = ((dev->size > 0) && (top > dev->size)) ? (dev->size) : (top);
+    int res = MDS_BOOT_DeviceEraseSector(dev, erase->ofs, top - erase->ofs);
+    if (res == 0) {
+        erase->ofs = top;
+    }
+
+    return (res);
+}
+
+static size_t BOOT_PageSize(const MDS_BOOT_Device_t *dev)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+    if ((ops != NULL) && (ops->pageSize <= g_bootUpgradePage.size)) {
+        return (ops->pageSize);
+    }
+
+    return (0);
+}
+
+#if (defined(MDS_BOOT_WITH_VERIFY) && (MDS_BOOT_WITH_VERIFY > 0))
+// a page only programs bits from 1 to 0, one holding a 0 the data wants as 1 needs its sector erased
+static bool BOOT_VerifyClearable(const uint8_t *back, const uint8_t *buff, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        if ((~back[i] & buff[i]) != 0) {
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+// read one page back, and with reprogram on program it again while it differs and its bits can still clear
+static int BOOT_VerifyPage(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *buff, size_t size)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+    uint16_t retryMax = ((ops != NULL) && (ops->reprogram)) ? (MDS_BOOT_VERIFY_RETRY) : (0);
+
+    for (uint16_t retry = 0;; retry++) {
+        const uint8_t *back = MDS_BOOT_DeviceMap(dev, ofs, size, false);
+        if (back == NULL) {
+            back = g_bootUpgradePage.back;
+            if (MDS_BOOT_DeviceRead(dev, ofs, g_bootUpgradePage.back, size) != 0) {
+                return (MDS_BOOT_RESULT_EIO);
+            }
+        }
+
+        if (memcmp(back, buff, size) == 0) {
+            return (0);
+        } else if ((retry >= retryMax) || (!BOOT_VerifyClearable(back, buff, size))) {
+            g_bootUpgradeCheckpoint.mismatch = true;
+            return (MDS_BOOT_RESULT_EVERIFY);
+        }
+
+        g_bootUpgradeStat.reprogrammed += 1;
+        if (MDS_BOOT_DeviceWrite(dev, ofs, buff, size) != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+    }
+}
+
+// the image digest follows the install while its data lands in order, anything else leaves it to a rehash
+static void BOOT_VerifyImage(const MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *buff, uintptr_t end)
+{
+    struct BOOT_UpgradeExtent *extent = &g_bootUpgradeExtent;
+
+    if ((dev != extent->dev) || (!extent->follow) || (end <= extent->ofs)) {
+        return;
+    } else if (ofs > extent->ofs) {
+        extent->follow = false;
+        return;
+    }
+
+    // bytes behind the data end are padding of the program alignment, the next program writes them
+    extent->follow = (MDS_BOOT_DigestUpdate(&(extent->image), &(buff[extent->ofs - ofs]), end - extent->ofs) == 0);
+    extent->ofs = end;
+}
+
+// page by page, a failing page is programmed again without touching the rest of the range
+static int BOOT_Verify(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *buff, size_t size, uintptr_t end)
+{
+    size_t pageSize = BOOT_PageSize(dev);
+    pageSize = ((pageSize > 0) && (pageSize < MDS_BOOT_PAGE_SIZE)) ? (pageSize) : (MDS_BOOT_PAGE_SIZE);
+
+    if (g_bootUpgradePage.back == NULL) {
+        return (0);
+    }
+
+    for (size_t pos = 0; pos < size;) {
+        size_t len = pageSize - ((ofs + pos) % pageSize);
+        len = (len > (size - pos)) ? (size - pos) : (len);
+        int res = BOOT_VerifyPage(dev, ofs + pos, &(buff[pos]), len);
+        if (res != 0) {
+            return (res);
+        }
+        pos += len;
+    }
+    BOOT_VerifyImage(dev, ofs, buff, end);
+
+    return (0);
+}
+#else
+#define BOOT_Verify(dev, ofs, buff, size, end) (0)
+#endif
+
+static int BOOT_ProgramWait(void)
+{
+    struct BOOT_UpgradeProgram *program = &g_bootUpgradeProgram;
+    MDS_BOOT_Device_t *dev = program->dev;
+
+    if (dev == NULL) {
+        return (0);
+    }
+
+    program->dev = NULL;
+    uint32_t trace = MDS_BOOT_TRACE_BEGIN();
+    int res = MDS_BOOT_DeviceWait(dev);
+    MDS_BOOT_TRACE_END(MDS_BOOT_TRACE_WRITE, trace, 0);
+    if (res == 0) {
+        res = BOOT_Verify(dev, program->ofs, program->buff, program->size, program->end);
+    }
+    if (res == 0) {
+        BOOT_CheckpointWrite(program->end);
+    }
+
+    return (res);
+}
+
+// a buffer kept until the next program may be submitted, the caller's buffer is programmed synchronously
+static int BOOT_Program(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *buff, size_t size, uintptr_t end,
+                        bool keep)
+{
+    int res = BOOT_ProgramWait();
+    if (res != 0) {
+        return (res);
+    }
+
+    res = BOOT_EraseAhead(dev, ofs + size);
+    if (res != 0) {
+        return (res);
+    }
+
+    if (keep && BOOT_AsyncWrite(dev)) {
+        res = BOOT_DeviceWriteSubmit(dev, ofs, buff, size);
+        if (res == 0) {
+            g_bootUpgradeProgram.dev = dev;
+            g_bootUpgradeProgram.end = end;
+            g_bootUpgradeProgram.ofs = ofs;
+            g_bootUpgradeProgram.buff = buff;
+            g_bootUpgradeProgram.size = size;
+        }
+        return (res);
+    }
+
+    res = MDS_BOOT_DeviceWrite(dev, ofs, buff, size);
+    if (res == 0) {
+        res = BOOT_Verify(dev, ofs, buff, size, end);
+    }
+    if (res == 0) {
+        BOOT_CheckpointWrite(end);
+    }
+
+    return (res);
+}
+
+// program the buffered part of the page, widened to the program alignment
+static int BOOT_PageFlush(void)
+{
+    struct BOOT_UpgradePage *page = &g_bootUpgradePage;
+
+    if (page->dev == NULL) {
+        return (0);
+    }
+
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(page->dev);
+    size_t pageSize = BOOT_PageSize(page->dev);
+    size_t alignSize = (ops->alignSize > 0) ? (ops->alignSize) : (1);
+    size_t lo = page->lo - (page->lo % alignSize);
+    size_t hi = ((page->hi + alignSize - 1) / alignSize) * alignSize;
+    hi = (hi > pageSize) ? (pageSize) : (hi);
+
+    MDS_BOOT_Device_t *dev = page->dev;
+    uint8_t *buff = page->buff[page->idx];
+    page->dev = NULL;
+    page->idx = (page->idx + 1) % MDS_BOOT_BUFF_NUM;
+
+    return (BOOT_Program(dev, page->base + lo, &(buff[lo]), hi - lo, page->base + page->hi, true));
+}
+
+// gather output into full program pages, whole pages of the caller buffer are programmed in place
+static int BOOT_PageWrite(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *buff, size_t size)
+{
+    struct BOOT_UpgradePage *page = &g_bootUpgradePage;
+    size_t pageSize = BOOT_PageSize(dev);
+    int res;
+
+    if (pageSize == 0) {
+        return (BOOT_Program(dev, ofs, buff, size, ofs + size, false));
+    }
+
+    while (size > 0) {
+        uintptr_t base = ofs - (ofs % pageSize);
+        size_t len;
+
+        if ((page->dev == NULL) && (ofs == base) && (size >= pageSize)) {
+            len = size - (size % pageSize);
+            res = BOOT_Program(dev, ofs, buff, len, ofs + len, false);
+            if (res != 0) {
+                return (res);
+            }
+        } else {
+            if ((page->dev != dev) || (page->base != base)) {
+                res = BOOT_PageFlush();
+                if (res != 0) {
+                    return (res);
+                }
+
+                memset(page->buff[page->idx], MDS_BOOT_SECTOR_BLANK, pageSize);
+                page->dev = dev;
+                page->base = base;
+                page->lo = ofs - base;
+                page->hi = ofs - base;
+            }
+
+            size_t pos = ofs - base;
+            len = ((pageSize - pos) > size) ? (size) : (pageSize - pos);
+            memcpy(&(page->buff[page->idx][pos]), buff, len);
+            page->lo = (pos < page->lo) ? (pos) : (page->lo);
+            page->hi = ((pos + len) > page->hi) ? (pos + len) : (page->hi);
+
+            if ((page->lo == 0) && (page->hi == pageSize)) {
+                res = BOOT_PageFlush();
+                if (res != 0) {
+                    return (res);
+                }
+            }
+        }
+
+        ofs += len;
+        buff += len;
+        size -= len;
+    }
+
+    return (0);
+}
+
+#if (defined(MDS_BOOT_WITH_COMPARE) && (MDS_BOOT_WITH_COMPARE > 0))
+static bool BOOT_SectorEnable(const MDS_BOOT_Device_t *dev)
+{
+    return ((BOOT_DeviceEraseSectorable(dev)) && (BOOT_SectorSize(dev) <= g_bootUpgradeSector.size));
+}
+
+static int BOOT_SectorFlush(void)
+{
+    struct BOOT_UpgradeSector *sector = &g_bootUpgradeSector;
+    int res = 0;
+
+    if (sector->dev == NULL) {
+        return (0);
+    }
+
+    size_t sectorSize = BOOT_SectorSize(sector->dev);
+    res = BOOT_ProgramWait();
+    if (res != 0) {
+        return (res);
+    }
+
+    g_bootUpgradeStat.sectors += 1;
+    if (!sector->dirty) {
+        g_bootUpgradeStat.skipped += 1;
+    } else if (!sector->erase) {
+        res = BOOT_PageWrite(sector->dev, sector->base + sector->lo, &(sector->buff[sector->lo]),
+                             sector->hi - sector->lo);
+        g_bootUpgradeStat.programmed += 1;
+    } else {
+        res = MDS_BOOT_DeviceEraseSector(sector->dev, sector->base, sectorSize);
+        if (res == 0) {
+            res = BOOT_PageWrite(sector->dev, sector->base, sector->buff, sectorSize);
+        }
+        g_bootUpgradeStat.erased += 1;
+    }
+
+    if (res == 0) {
+        res = BOOT_PageFlush();
+    }
+    if (res == 0) {
+        res = BOOT_ProgramWait();
+    }
+
+    sector->dev = NULL;
+    if (res == 0) {
+        BOOT_CheckpointWrite(sector->base + sector->hi);
+    }
+
+    return (res);
+}
+
+// overlay the incoming data on the sector read back from the device, bytes outside the written span are kept
+static int BOOT_SectorWrite(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *buff, size_t size)
+{
+    struct BOOT_UpgradeSector *sector = &g_bootUpgradeSector;
+    size_t sectorSize = BOOT_SectorSize(dev);
+
+    while (size > 0) {
+        uintptr_t base = ofs - (ofs % sectorSize);
+        if ((sector->dev != dev) || (sector->base != base)) {
+            int res = BOOT_SectorFlush();
+            if (res != 0) {
+                return (res);
+            }
+
+            res = MDS_BOOT_DeviceRead(dev, base, sector->buff, sectorSize);
+            if (res != 0) {
+                return (res);
+            }
+
+            sector->dev = dev;
+            sector->base = base;
+            sector->lo = ofs - base;
+            sector->hi = ofs - base;
+            sector->dirty = false;
+            sector->erase = false;
+        }
+
+        size_t pos = ofs - base;
+        size_t len = ((sectorSize - pos) > size) ? (size) : (sectorSize - pos);
+        if (memcmp(&(sector->buff[pos]), buff, len) != 0) {
+            sector->dirty = true;
+            for (size_t i = 0; (i < len) && (!sector->erase); i++) {
+                if ((sector->buff[pos + i] != buff[i]) && (sector->buff[pos + i] != MDS_BOOT_SECTOR_BLANK)) {
+                    sector->erase = true;
+                }
+            }
+            memcpy(&(sector->buff[pos]), buff, len);
+        }
+
+        sector->lo = (pos < sector->lo) ? (pos) : (sector->lo);
+        sector->hi = ((pos + len) > sector->hi) ? (pos + len) : (sector->hi);
+        ofs += len;
+        buff += len;
+        size -= len;
+    }
+
+    return (0);
+}
+#endif
+
+// a writable map bypasses MDS_BOOT_UpgradeWrite, so it is only handed out while no checkpoint, compare or read back
+// follows the writes, the whole range counts as written
+uint8_t *MDS_BOOT_UpgradeWindow(MDS_BOOT_Device_t *dst, uintptr_t ofs, size_t size)
+{
+#if (defined(MDS_BOOT_WITH_VERIFY) && (MDS_BOOT_WITH_VERIFY > 0))
+    (void)(dst);
+    (void)(ofs);
+    (void)(size);
+
+    return (NULL);
+#else
+    if (g_bootUpgradeCheckpoint.swapInfo != NULL) {
+        return (NULL);
+    }
+#if (defined(MDS_BOOT_WITH_COMPARE) && (MDS_BOOT_WITH_COMPARE > 0))
+    if (BOOT_SectorEnable(dst)) {
+        return (NULL);
+    }
+#endif
+
+    uint8_t *window = MDS_BOOT_DeviceMap(dst, ofs, size, true);
+    if ((window != NULL) && (dst == g_bootUpgradeExtent.dev) && ((ofs + size) > g_bootUpgradeExtent.size)) {
+        g_bootUpgradeExtent.size = ofs + size;
+    }
+
+    return (window);
+#endif
+}
+
+int MDS_BOOT_UpgradeWrite(MDS_BOOT_Device_t *dst, uintptr_t ofs, const uint8_t *buff, size_t size)
+{
+    struct BOOT_UpgradeCheckpoint *ckpt = &g_bootUpgradeCheckpoint;
+
+    if (ckpt->yield) {
+        return (MDS_BOOT_RESULT_EAGAIN);
+    }
+
+    if ((dst == g_bootUpgradeExtent.dev) && ((ofs + size) > g_bootUpgradeExtent.size)) {
+        g_bootUpgradeExtent.size = ofs + size;
+    }
+
+    // already committed before the last power loss
+    if (ckpt->resumeOfs > ofs) {
+        size_t skip = ((ckpt->resumeOfs - ofs) > size) ? (size) : (ckpt->resumeOfs - ofs);
+        ofs += skip;
+        buff += skip;
+        size -= skip;
+        if (size == 0) {
+            return (0);
+        }
+    }
+    ckpt->spent += size;
+
+#if (defined(MDS_BOOT_WITH_COMPARE) && (MDS_BOOT_WITH_COMPARE > 0))
+    if (BOOT_SectorEnable(dst)) {
+        return (BOOT_SectorWrite(dst, ofs, buff, size));
+    }
+#endif
+
+    return (BOOT_PageWrite(dst, ofs, buff, size));
+}
+
+int MDS_BOOT_UpgradeFlush(void)
+{
+    int res = 0;
+
+#if (defined(MDS_BOOT_WITH_COMPARE) && (MDS_BOOT_WITH_COMPARE > 0))
+    res = BOOT_SectorFlush();
+    if (res != 0) {
+        return (res);
+    }
+#endif
+
+    res = BOOT_PageFlush();
+    if (res != 0) {
+        return (res);
+    }
+
+    return (BOOT_ProgramWait());
+}
+
+uintptr_t MDS_BOOT_UpgradeResume(void)
+{
+    return (g_bootUpgradeCheckpoint.resumeOfs);
+}
+
+// image a delta bin to dst is patched from, the active slot while the install goes to the inactive one
+MDS_BOOT_Device_t *MDS_BOOT_UpgradeBase(MDS_BOOT_Device_t *dst)
+{
+    const struct BOOT_UpgradeExtent *extent = &g_bootUpgradeExtent;
+
+    return (((extent->dev == dst) && (extent->base != NULL)) ? (extent->base) : (dst));
+}
+
+uint16_t MDS_BOOT_UpgradeGetPhase(void)
+{
+    return (g_bootUpgradeCheckpoint.phase);
+}
+
+void MDS_BOOT_UpgradeSetPhase(uint16_t phase)
+{
+    struct BOOT_UpgradeCheckpoint *ckpt = &g_bootUpgradeCheckpoint;
+
+    ckpt->phase = phase;
+    ckpt->resumeOfs = 0;
+    ckpt->dstOfs = 0;
+
+    BOOT_CheckpointCommit();
+}
+
+int MDS_BOOT_UpgradeErase(MDS_BOOT_Device_t *dst)
+{
+#if (defined(MDS_BOOT_WITH_COMPARE) && (MDS_BOOT_WITH_COMPARE > 0))
+    // sectors are erased on flush, only where the content differs
+    if (BOOT_SectorEnable(dst)) {
+        return (0);
+    }
+#endif
+
+    // sectors are erased just ahead of the write cursor, the one holding the resume point is already erased
+    if (BOOT_EraseLazy(dst)) {
+        size_t sectorSize = BOOT_SectorSize(dst);
+        g_bootUpgradeErase.dev = dst;
+        g_bootUpgradeErase.ofs = ((g_bootUpgradeCheckpoint.resumeOfs + sectorSize - 1) / sectorSize) * sectorSize;
+        return (0);
+    }
+
+    if (g_bootUpgradeCheckpoint.resumeOfs > 0) {
+        return (0);
+    }
+
+    return (MDS_BOOT_DeviceErase(dst));
+}
+
+static void BOOT_CheckpointOpen(MDS_BOOT_SwapInfo_t *swapInfo, const MDS_BOOT_UpgradeInfo_t *upgradeInfo,
+                                uint32_t binOfs)
+{
+    struct BOOT_UpgradeCheckpoint *ckpt = &g_bootUpgradeCheckpoint;
+
+    memset(ckpt, 0, sizeof(*ckpt));
+    if (swapInfo == NULL) {
+        return;
+    }
+
+    ckpt->swapInfo = swapInfo;
+    if ((swapInfo->checkpoint.binOfs >= binOfs) && (swapInfo->magic == ALGO_GetU32BE(upgradeInfo->magic)) &&
+        (swapInfo->size == ALGO_GetU32BE(upgradeInfo->size)) &&
+        (memcmp(swapInfo->hash, upgradeInfo->hash, sizeof(swapInfo->hash)) == 0)) {
+        return;  // same package, resume from the checkpoint
+    }
+
+    swapInfo->magic = ALGO_GetU32BE(upgradeInfo->magic);
+    swapInfo->count = ALGO_GetU16BE(upgradeInfo->count);
+    swapInfo->size = ALGO_GetU32BE(upgradeInfo->size);
+    memcpy(swapInfo->hash, upgradeInfo->hash, sizeof(upgradeInfo->hash));
+
+    memset(&(swapInfo->checkpoint), 0, sizeof(swapInfo->checkpoint));
+    swapInfo->checkpoint.binOfs = binOfs;
+    BOOT_SwapInfoCommit(swapInfo);
+}
+
+static void BOOT_CheckpointBin(uint16_t index)
+{
+    struct BOOT_UpgradeCheckpoint *ckpt = &g_bootUpgradeCheckpoint;
+
+    ckpt->phase = 0;
+    ckpt->resumeOfs = 0;
+    if ((ckpt->swapInfo != NULL) && (ckpt->swapInfo->checkpoint.index == index)) {
+        ckpt->phase = ckpt->swapInfo->checkpoint.phase;
+        ckpt->resumeOfs = ckpt->swapInfo->checkpoint.dstOfs;
+    }
+    ckpt->syncOfs = ckpt->resumeOfs;
+    ckpt->dstOfs = ckpt->resumeOfs;
+
+    memset(&g_bootUpgradePage, 0, sizeof(g_bootUpgradePage));
+    memset(&g_bootUpgradeErase, 0, sizeof(g_bootUpgradeErase));
+#if (defined(MDS_BOOT_WITH_COMPARE) && (MDS_BOOT_WITH_COMPARE > 0))
+    memset(&g_bootUpgradeSector, 0, sizeof(g_bootUpgradeSector));
+#endif
+}
+
+// page size of the device if it fits the configured buffer, 0 programs straight from the caller
+static size_t BOOT_BufferPage(const MDS_BOOT_Device_t *dev)
+{
+    const MDS_BOOT_UpgradeOps_t *ops = BOOT_DeviceOps(dev);
+
+    return (((dev != NULL) && (ops != NULL) && (ops->pageSize <= MDS_BOOT_PAGE_SIZE)) ? (ops->pageSize) : (0));
+}
+
+#if (defined(MDS_BOOT_WITH_COMPARE) && (MDS_BOOT_WITH_COMPARE > 0))
+static size_t BOOT_BufferSector(const MDS_BOOT_Device_t *dev)
+{
+    if ((dev == NULL) || (!BOOT_DeviceEraseSectorable(dev)) || (BOOT_SectorSize(dev) > MDS_BOOT_SECTOR_SIZE)) {
+        return (0);
+    }
+
+    return (BOOT_SectorSize(dev));
+}
+#endif
+
+// take the page and sector buffers the bin writes through, sized for its destination and the stage device
+static MDS_BOOT_Result_t BOOT_UpgradeBuffer(MDS_BOOT_Device_t *dst)
+{
+    struct BOOT_UpgradePage *page = &g_bootUpgradePage;
+    MDS_BOOT_Device_t *stage = MDS_BOOT_GetStageDevice();
+    size_t size = BOOT_BufferPage(dst);
+
+    size = (BOOT_BufferPage(stage) > size) ? (BOOT_BufferPage(stage)) : (size);
+    for (size_t i = 0; (size > 0) && (i < MDS_BOOT_BUFF_NUM); i++) {
+        page->buff[i] = MDS_BOOT_ArenaAlloc(size);
+        if (page->buff[i] == NULL) {
+            return (MDS_BOOT_RESULT_ENOMEM);
+        }
+    }
+    page->size = size;
+
+#if (defined(MDS_BOOT_WITH_VERIFY) && (MDS_BOOT_WITH_VERIFY > 0))
+    page->back = MDS_BOOT_ArenaAlloc(MDS_BOOT_PAGE_SIZE);
+    if (page->back == NULL) {
+        return (MDS_BOOT_RESULT_ENOMEM);
+    }
+#endif
+
+#if (defined(MDS_BOOT_WITH_COMPARE) && (MDS_BOOT_WITH_COMPARE > 0))
+    struct BOOT_UpgradeSector *sector = &g_bootUpgradeSector;
+
+    size = BOOT_BufferSector(dst);
+    size = (BOOT_BufferSector(stage) > size) ? (BOOT_BufferSector(stage)) : (size);
+    if (size > 0) {
+        sector->buff = MDS_BOOT_ArenaAlloc(size);
+        if (sector->buff == NULL) {
+            return (MDS_BOOT_RESULT_ENOMEM);
+        }
+    }
+    sector->size = size;
+#endif
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static void BOOT_CheckpointNext(uint16_t index, uint32_t binOfs, const MDS_BOOT_Digest_t *digest)
+{
+    struct BOOT_UpgradeCheckpoint *ckpt = &g_bootUpgradeCheckpoint;
+
+    ckpt->phase = 0;
+    ckpt->resumeOfs = 0;
+    ckpt->dstOfs = 0;
+    if (ckpt->swapInfo != NULL) {
+        ckpt->swapInfo->checkpoint.index = index;
+        ckpt->swapInfo->checkpoint.binOfs = binOfs;
+        if (digest != NULL) {
+            ckpt->swapInfo->checkpoint.digest = *digest;
+        }
+    }
+
+    BOOT_CheckpointCommit();
+}
+
+// read the next chunk into the other check buffer, a failed submit is retried synchronously by the caller
+static size_t BOOT_CheckReadNext(MDS_BOOT_Device_t *src, uintptr_t ofs, size_t size, uint8_t *buff[], size_t idx)
+{
+    size_t len = (size > MDS_BOOT_CHECK_SIZE) ? (MDS_BOOT_CHECK_SIZE) : (size);
+
+    if ((MDS_BOOT_BUFF_NUM < 2) || (len == 0) ||
+        (MDS_BOOT_UpgradeReadSubmit(src, ofs, buff[(idx + 1) % MDS_BOOT_BUFF_NUM], len) != 0)) {
+        return (0);
+    }
+
+    return (len);
+}
+
+static MDS_BOOT_Result_t BOOT_CheckHash(MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t size,
+                                        uint8_t hash[MDS_BOOT_CHKHASH_SIZE])
+{
+    MDS_BOOT_Digest_t ctx;
+    uint8_t digest[MDS_BOOT_CHKHASH_SIZE];
+    uint8_t *buff[MDS_BOOT_BUFF_NUM];
+    MDS_BOOT_Result_t result = MDS_BOOT_RESULT_SUCCESS;
+    size_t mark = MDS_BOOT_ArenaMark();
+
+    if (MDS_BOOT_DigestInit(&ctx) != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    // a dma engine hashes a mapped source straight from flash
+    const uint8_t *data = MDS_BOOT_DeviceMap(src, srcOfs, size, false);
+    if (data != NULL) {
+        result = (MDS_BOOT_DigestUpdate(&ctx, data, size) != 0) ? (MDS_BOOT_RESULT_EIO) : (result);
+        size = 0;
+    } else if (!BOOT_CheckBuffAlloc(buff)) {
+        result = MDS_BOOT_RESULT_ENOMEM;
+    }
+
+    // hash chunk n while chunk n+1 is read into the other buffer, a buffer is read again once its hash is done
+    for (size_t idx = 0, pending = 0; (result == MDS_BOOT_RESULT_SUCCESS) && (size > 0);
+         idx = (idx + 1) % MDS_BOOT_BUFF_NUM) {
+        size_t len = (size > MDS_BOOT_CHECK_SIZE) ? (MDS_BOOT_CHECK_SIZE) : (size);
+        if ((MDS_BOOT_DigestWait(&ctx) != 0) ||
+            ((pending == 0) && (MDS_BOOT_UpgradeReadSubmit(src, srcOfs, buff[idx], len) != 0)) ||
+            (MDS_BOOT_UpgradeReadWait(src) != 0)) {
+            result = MDS_BOOT_RESULT_EIO;
+            break;
+        }
+
+        pending = BOOT_CheckReadNext(src, srcOfs + len, size - len, buff, idx);
+
+        if (MDS_BOOT_DigestSubmit(&ctx, buff[idx], len) != 0) {
+            result = MDS_BOOT_RESULT_EIO;
+        }
+        srcOfs += len;
+        size -= len;
+    }
+
+    if ((MDS_BOOT_DigestWait(&ctx) != 0) && (result == MDS_BOOT_RESULT_SUCCESS)) {
+        result = MDS_BOOT_RESULT_EIO;
+    }
+    MDS_BOOT_ArenaRelease(mark);
+
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
+    }
+
+    if (MDS_BOOT_DigestFinish(&ctx, digest) != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    if (memcmp(hash, digest, sizeof(digest)) != 0) {
+        return (MDS_BOOT_RESULT_ECHECK);
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_CheckUpgradeHeader(MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                                 MDS_BOOT_UpgradeInfo_t *upgradeInfo)
+{
+    int res = MDS_BOOT_DeviceRead(src, srcOfs, (uint8_t *)(upgradeInfo), sizeof(*upgradeInfo));
+    if (res != 0) {
+        return (MDS_BOOT_RESULT_NONE);  // jump to application
+    }
+
+    if (ALGO_GetU32BE(upgradeInfo->magic) != MDS_BOOT_UPGRADE_MAGIC) {
+        return (MDS_BOOT_RESULT_ECHECK);
+    }
+
+    uint16_t check = MDS_BOOT_Crc16(0, (uint8_t *)(&(upgradeInfo->magic)),
+                                    sizeof(*upgradeInfo) - sizeof(upgradeInfo->check));
+    if (check != ALGO_GetU16BE(upgradeInfo->check)) {
+        return (MDS_BOOT_RESULT_ECHECK);
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+// region of the partition holding dstAddr, the bin is written from its offset 0, NULL if no partition holds it
+static MDS_BOOT_Device_t *BOOT_UpgradeRoute(MDS_BOOT_Device_t *dst, const MDS_BOOT_BinInfo_t *binInfo)
+{
+    uint32_t dstAddr = ALGO_GetU32BE(binInfo->dstAddr);
+
+    if (g_bootPartitionTable == NULL) {
+        return (dst);
+    }
+
+    for (uint16_t i = 0; i < g_bootPartitionCount; i++) {
+        const MDS_BOOT_Partition_t *part = &(g_bootPartitionTable[i]);
+        if ((part->dev == NULL) || (dstAddr < part->addr) || ((dstAddr - part->addr) >= part->size)) {
+            continue;
+        }
+
+        g_bootBinDevice = *(part->dev);
+        g_bootBinDevice.ofs = part->dev->ofs + (dstAddr - part->addr);
+        g_bootBinDevice.size = part->size - (dstAddr - part->addr);
+        return (&g_bootBinDevice);
+    }
+
+    return (NULL);
+}
+
+static MDS_BOOT_Result_t BOOT_CheckAllBinInfo(MDS_BOOT_Device_t *src, size_t srcOfs,
+                                              const MDS_BOOT_UpgradeInfo_t *upgradeInfo)
+{
+    MDS_BOOT_Result_t result = MDS_BOOT_RESULT_SUCCESS;
+    uint16_t cnt = ALGO_GetU16BE(upgradeInfo->count);
+
+    for (uint16_t i = 0; i < cnt; i++) {
+        MDS_BOOT_BinInfo_t binInfo = {0};
+
+        int res = MDS_BOOT_DeviceRead(src, srcOfs, (uint8_t *)(&binInfo), sizeof(binInfo));
+        if (res != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        uint16_t check = MDS_BOOT_Crc16(0, (uint8_t *)(&(binInfo.flag)), sizeof(binInfo) - sizeof(binInfo.check));
+        if (check != ALGO_GetU16BE(binInfo.check)) {
+            return (MDS_BOOT_RESULT_ECHECK);
+        }
+
+        uint32_t srcSize = ALGO_GetU32BE(binInfo.srcSize);
+        result = BOOT_CheckHash(src, srcOfs + sizeof(binInfo), srcSize, binInfo.hash);
+        if (result != MDS_BOOT_RESULT_SUCCESS) {
+            break;
+        }
+
+        srcOfs += sizeof(binInfo) + srcSize;
+    }
+
+    return (result);
+}
+
+#if (defined(MDS_BOOT_WITH_COPY) && (MDS_BOOT_WITH_COPY > 0))
+static MDS_BOOT_Result_t BOOT_ReserveCopy(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                          uint32_t srcSize)
+{
+    uint8_t *buff[MDS_BOOT_BUFF_NUM];
+
+    (void)(dst);
+    (void)(src);
+    (void)(srcOfs);
+    (void)(srcSize);
+
+    return ((BOOT_CheckBuffAlloc(buff)) ? (MDS_BOOT_RESULT_SUCCESS) : (MDS_BOOT_RESULT_ENOMEM));
+}
+#endif
+
+static const MDS_BOOT_Codec_t G_BOOT_CODEC[] = {
+#if (defined(MDS_BOOT_WITH_COPY) && (MDS_BOOT_WITH_COPY > 0))
+    {MDS_BOOT_FLAG_COPY, MDS_BOOT_UpgradeCopy, BOOT_ReserveCopy},
+#endif
+#if (defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0))
+    {MDS_BOOT_FLAG_LZ4, MDS_BOOT_UpgradeLz4, MDS_BOOT_ReserveLz4},
+#endif
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+    {MDS_BOOT_FLAG_LZMA, MDS_BOOT_UpgradeLzma, MDS_BOOT_ReserveLzma},
+    {MDS_BOOT_FLAG_LZMA_BLOCK, MDS_BOOT_UpgradeLzmaBlock, MDS_BOOT_ReserveLzmaBlock},
+#endif
+#if (defined(MDS_BOOT_WITH_DELTA) && (MDS_BOOT_WITH_DELTA > 0))
+    {MDS_BOOT_FLAG_DELTA, MDS_BOOT_UpgradeDelta, MDS_BOOT_ReserveDelta},
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+    {MDS_BOOT_FLAG_DELTA_LZMA, MDS_BOOT_UpgradeDeltaLzma, MDS_BOOT_ReserveDeltaLzma},
+#endif
+#endif
+    {MDS_BOOT_FLAG_NONE, NULL, NULL},
+};
+
+// codec installing the flag, the codecs set by the application come first and may replace a built-in one
+static const MDS_BOOT_Codec_t *BOOT_UpgradeCodec(uint16_t flag)
+{
+    for (uint16_t i = 0; i < g_bootCodecCount; i++) {
+        if ((g_bootCodecTable[i].flag == flag) && (g_bootCodecTable[i].upgrade != NULL)) {
+            return (&(g_bootCodecTable[i]));
+        }
+    }
+
+    for (size_t i = 0; G_BOOT_CODEC[i].upgrade != NULL; i++) {
+        if (G_BOOT_CODEC[i].flag == flag) {
+            return (&(G_BOOT_CODEC[i]));
+        }
+    }
+
+    return (NULL);
+}
+
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+// take the crypt info in front of an encrypted bin, the codec then reads plaintext behind it
+static MDS_BOOT_Result_t BOOT_CryptOpen(MDS_BOOT_Device_t *src, uint32_t *srcOfs, uint32_t *srcSize,
+                                        uint16_t *flag)
+{
+    struct BOOT_UpgradeCrypt *crypt = &g_bootUpgradeCrypt;
+    MDS_BOOT_CryptInfo_t cryptInfo;
+
+    if ((*flag & MDS_BOOT_FLAG_CRYPT) == 0) {
+        return (MDS_BOOT_RESULT_SUCCESS);
+    }
+
+    *flag &= (uint16_t)(~MDS_BOOT_FLAG_CRYPT);
+    if ((g_bootCryptOps == NULL) || ((g_bootCryptOps->key == NULL) && (g_bootCryptOps->ctr == NULL)) ||
+        (*srcSize < sizeof(cryptInfo)) ||
+        (MDS_BOOT_UpgradeRead(src, *srcOfs, (uint8_t *)(&cryptInfo), sizeof(cryptInfo)) != 0)) {
+        return (MDS_BOOT_RESULT_ECRYPT);
+    }
+
+    *srcOfs += sizeof(cryptInfo);
+    *srcSize -= sizeof(cryptInfo);
+    crypt->src = src;
+    crypt->ofs = *srcOfs;
+    crypt->end = *srcOfs + *srcSize;
+    memcpy(crypt->iv, cryptInfo.iv, sizeof(crypt->iv));
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static void BOOT_CryptClose(void)
+{
+    memset(&g_bootUpgradeCrypt, 0, sizeof(g_bootUpgradeCrypt));
+}
+
+// package offset of the bin an engine was handed srcOfs of, an encrypted one starts at its crypt info
+static uint32_t BOOT_CryptOrigin(uint32_t srcOfs)
+{
+    const struct BOOT_UpgradeCrypt *crypt = &g_bootUpgradeCrypt;
+
+    if ((crypt->src != NULL) && (srcOfs == crypt->ofs)) {
+        return (srcOfs - sizeof(MDS_BOOT_CryptInfo_t));
+    }
+
+    return (srcOfs);
+}
+#else
+static MDS_BOOT_Result_t BOOT_CryptOpen(MDS_BOOT_Device_t *src, uint32_t *srcOfs, uint32_t *srcSize,
+                                        uint16_t *flag)
+{
+    (void)(src);
+    (void)(srcOfs);
+    (void)(srcSize);
+    (void)(flag);
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+#define BOOT_CryptClose()
+#define BOOT_CryptOrigin(srcOfs) (srcOfs)
+#endif
+
+static MDS_BOOT_Result_t BOOT_UpgradeSwtich(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                            uint32_t srcSize, uint16_t flag)
+{
+    uint16_t codecFlag = flag;
+    MDS_BOOT_Result_t result = BOOT_CryptOpen(src, &srcOfs, &srcSize, &codecFlag);
+    const MDS_BOOT_Codec_t *codec = BOOT_UpgradeCodec(codecFlag);
+
+    if (codec == NULL) {
+        result = MDS_BOOT_RESULT_NONE;
+    } else if (result == MDS_BOOT_RESULT_SUCCESS) {
+        result = codec->upgrade(dst, src, srcOfs, srcSize);
+    }
+    BOOT_CryptClose();
+
+    return (result);
+}
+
+static MDS_BOOT_Result_t BOOT_UpgradeReserve(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                             uint32_t srcSize, uint16_t flag)
+{
+    uint16_t codecFlag = flag;
+    MDS_BOOT_Result_t result = BOOT_CryptOpen(src, &srcOfs, &srcSize, &codecFlag);
+    const MDS_BOOT_Codec_t *codec = BOOT_UpgradeCodec(codecFlag);
+
+    if ((result == MDS_BOOT_RESULT_SUCCESS) && (codec != NULL) && (codec->reserve != NULL)) {
+        result = codec->reserve(dst, src, srcOfs, srcSize);
+    }
+    BOOT_CryptClose();
+
+    return (result);
+}
+
+// walk the bin headers and take every buffer each bin will take, so a package the arena cannot hold is
+// rejected before anything is erased
+static MDS_BOOT_Result_t BOOT_CheckBinBuffer(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, size_t srcOfs,
+                                             const MDS_BOOT_UpgradeInfo_t *upgradeInfo)
+{
+    MDS_BOOT_Result_t result = MDS_BOOT_RESULT_SUCCESS;
+    size_t endOfs = srcOfs + ALGO_GetU32BE(upgradeInfo->size);
+    uint16_t cnt = ALGO_GetU16BE(upgradeInfo->count);
+
+    for (uint16_t i = 0; (i < cnt) && (result == MDS_BOOT_RESULT_SUCCESS); i++) {
+        MDS_BOOT_BinInfo_t binInfo = {0};
+
+        int res = MDS_BOOT_DeviceRead(src, srcOfs, (uint8_t *)(&binInfo), sizeof(binInfo));
+        if (res != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        uint16_t check = MDS_BOOT_Crc16(0, (uint8_t *)(&(binInfo.flag)), sizeof(binInfo) - sizeof(binInfo.check));
+        uint32_t srcSize = ALGO_GetU32BE(binInfo.srcSize);
+        MDS_BOOT_Device_t *binDst = BOOT_UpgradeRoute(dst, &binInfo);
+        if ((check != ALGO_GetU16BE(binInfo.check)) || ((srcOfs + sizeof(binInfo) + srcSize) > endOfs) ||
+            (binDst == NULL)) {
+            return (MDS_BOOT_RESULT_ECHECK);
+        }
+
+        size_t mark = MDS_BOOT_ArenaMark();
+        result = BOOT_UpgradeBuffer(binDst);
+        if (result == MDS_BOOT_RESULT_SUCCESS) {
+            result = BOOT_UpgradeReserve(binDst, src, srcOfs + sizeof(binInfo), srcSize, ALGO_GetU16BE(binInfo.flag));
+        }
+        MDS_BOOT_ArenaRelease(mark);
+
+        srcOfs += sizeof(binInfo) + srcSize;
+    }
+
+    return (result);
+}
+
+static MDS_BOOT_Result_t BOOT_UpgradeBinInfo(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, size_t srcOfs,
+                                             const MDS_BOOT_UpgradeInfo_t *upgradeInfo)
+{
+    uint16_t cnt = ALGO_GetU16BE(upgradeInfo->count);
+    uint16_t i = 0;
+
+    if (g_bootUpgradeCheckpoint.swapInfo != NULL) {
+        i = g_bootUpgradeCheckpoint.swapInfo->checkpoint.index;
+        srcOfs = g_bootUpgradeCheckpoint.swapInfo->checkpoint.binOfs;
+    }
+
+    for (; i < cnt; i++) {
+        MDS_BOOT_BinInfo_t binInfo = {0};
+
+        if (g_bootUpgradeCheckpoint.yield) {
+            return (MDS_BOOT_RESULT_EAGAIN);  // the next bin starts with the next step
+        }
+
+        int res = MDS_BOOT_DeviceRead(src, srcOfs, (uint8_t *)(&binInfo), sizeof(binInfo));
+        if (res != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        MDS_BOOT_Device_t *binDst = BOOT_UpgradeRoute(dst, &binInfo);
+        if (binDst == NULL) {
+            return (MDS_BOOT_RESULT_ECHECK);
+        }
+
+        uint16_t flag = ALGO_GetU16BE(binInfo.flag);
+        uint32_t srcSize = ALGO_GetU32BE(binInfo.srcSize);
+        size_t mark = MDS_BOOT_ArenaMark();
+        BOOT_CheckpointBin(i);
+        MDS_BOOT_Result_t result = BOOT_UpgradeBuffer(binDst);
+        if (result == MDS_BOOT_RESULT_SUCCESS) {
+            result = BOOT_UpgradeSwtich(binDst, src, srcOfs + sizeof(binInfo), srcSize, flag);
+        }
+        if (result != MDS_BOOT_RESULT_SUCCESS) {
+            return (result);
+        } else if (MDS_BOOT_UpgradeFlush() != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+        MDS_BOOT_ArenaRelease(mark);
+
+        srcOfs += sizeof(binInfo) + srcSize;
+        BOOT_CheckpointNext(i + 1, srcOfs, NULL);
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_UpgradeDrain(MDS_BOOT_Device_t *src, uintptr_t endOfs)
+{
+    struct BOOT_UpgradeDigest *digest = &g_bootUpgradeDigest;
+
+    if (digest->ofs > endOfs) {
+        return (MDS_BOOT_RESULT_EVERIFY);
+    }
+
+    int res = MDS_BOOT_UpgradeSkip(src, digest->ofs, endOfs - digest->ofs);
+    if (res != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+// hash the same chunks that feed the engines, dst holds the image only once every digest matches
+static MDS_BOOT_Result_t BOOT_UpgradeFused(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, size_t srcOfs,
+                                           const MDS_BOOT_UpgradeInfo_t *upgradeInfo)
+{
+    MDS_BOOT_Result_t result = MDS_BOOT_RESULT_SUCCESS;
+    struct BOOT_UpgradeDigest *digest = &g_bootUpgradeDigest;
+    uint8_t sum[MDS_BOOT_CHKHASH_SIZE];
+    size_t endOfs = srcOfs + ALGO_GetU32BE(upgradeInfo->size);
+    uint16_t cnt = ALGO_GetU16BE(upgradeInfo->count);
+    uint16_t i = 0;
+
+    digest->res = MDS_BOOT_DigestInit(&(digest->total));
+    if ((g_bootUpgradeCheckpoint.swapInfo != NULL) && (g_bootUpgradeCheckpoint.swapInfo->checkpoint.index > 0)) {
+        i = g_bootUpgradeCheckpoint.swapInfo->checkpoint.index;
+        srcOfs = g_bootUpgradeCheckpoint.swapInfo->checkpoint.binOfs;
+        digest->total = g_bootUpgradeCheckpoint.swapInfo->checkpoint.digest;
+    }
+
+    for (; i < cnt; i++) {
+        MDS_BOOT_BinInfo_t binInfo = {0};
+
+        int res = MDS_BOOT_DeviceRead(src, srcOfs, (uint8_t *)(&binInfo), sizeof(binInfo));
+        if (res != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        uint16_t check = MDS_BOOT_Crc16(0, (uint8_t *)(&(binInfo.flag)), sizeof(binInfo) - sizeof(binInfo.check));
+        if (check != ALGO_GetU16BE(binInfo.check)) {
+            return ((i == 0) ? (MDS_BOOT_RESULT_ECHECK) : (MDS_BOOT_RESULT_EVERIFY));
+        }
+
+        uint16_t flag = ALGO_GetU16BE(binInfo.flag);
+        uint32_t srcSize = ALGO_GetU32BE(binInfo.srcSize);
+        MDS_BOOT_Device_t *binDst = BOOT_UpgradeRoute(dst, &binInfo);
+        if (((srcOfs + sizeof(binInfo) + srcSize) > endOfs) || (binDst == NULL)) {
+            return ((i == 0) ? (MDS_BOOT_RESULT_ECHECK) : (MDS_BOOT_RESULT_EVERIFY));
+        }
+
+        size_t mark = MDS_BOOT_ArenaMark();
+        BOOT_CheckpointBin(i);
+        if (digest->res == 0) {
+            digest->res = MDS_BOOT_DigestUpdate(&(digest->total), (uint8_t *)(&binInfo), sizeof(binInfo));
+        }
+        if (digest->res == 0) {
+            digest->res = MDS_BOOT_DigestInit(&(digest->bin));
+        }
+        digest->ofs = srcOfs + sizeof(binInfo);
+        digest->active = true;
+
+        result = BOOT_UpgradeBuffer(binDst);
+        if (result == MDS_BOOT_RESULT_SUCCESS) {
+            result = BOOT_UpgradeSwtich(binDst, src, srcOfs + sizeof(binInfo), srcSize, flag);
+        }
+        if (result == MDS_BOOT_RESULT_SUCCESS) {
+            result = BOOT_UpgradeDrain(src, srcOfs + sizeof(binInfo) + srcSize);
+        }
+        if ((result == MDS_BOOT_RESULT_SUCCESS) && (MDS_BOOT_UpgradeFlush() != 0)) {
+            result = MDS_BOOT_RESULT_EIO;
+        }
+
+        digest->active = false;
+        if (result != MDS_BOOT_RESULT_SUCCESS) {
+            return (result);
+        }
+        MDS_BOOT_ArenaRelease(mark);
+
+        if ((digest->res != 0) || (MDS_BOOT_DigestFinish(&(digest->bin), sum) != 0)) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+        if (memcmp(binInfo.hash, sum, sizeof(sum)) != 0) {
+            return (MDS_BOOT_RESULT_EVERIFY);
+        }
+
+        srcOfs += sizeof(binInfo) + srcSize;
+        BOOT_CheckpointNext(i + 1, srcOfs, &(digest->total));
+    }
+
+    // trailing bytes are still covered by the package hash
+    digest->ofs = srcOfs;
+    digest->active = true;
+    result = BOOT_UpgradeDrain(src, endOfs);
+    digest->active = false;
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
+    }
+
+    if ((digest->res != 0) || (MDS_BOOT_DigestFinish(&(digest->total), sum) != 0)) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+    if (memcmp(upgradeInfo->hash, sum, sizeof(sum)) != 0) {
+        return (MDS_BOOT_RESULT_EVERIFY);
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+static MDS_BOOT_Result_t BOOT_UpgradeOpen(MDS_BOOT_SwapInfo_t *swapInfo, const MDS_BOOT_UpgradeOps_t *ops)
+{
+    if (ops == NULL) {
+        return (MDS_BOOT_RESULT_NONE);
+    }
+
+    if ((swapInfo != NULL) && (swapInfo->retry >= MDS_BOOT_UPGRADE_RETRY)) {
+        return (MDS_BOOT_RESULT_ERETRY);
+    }
+
+    g_bootUpgradeOps = ops;
+    memset(&g_bootUpgradeStat, 0, sizeof(g_bootUpgradeStat));
+    g_bootUpgradeArena.used = 0;
+    g_bootUpgradeArena.peak = 0;
+#if (MDS_BOOT_WITH_TRACE > 0)
+    BOOT_TraceOpen();
+#endif
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+// resume tells whether the package can be read again from where the checkpoint left it
+static MDS_BOOT_Result_t BOOT_UpgradeClose(MDS_BOOT_SwapInfo_t *swapInfo, const MDS_BOOT_UpgradeInfo_t *upgradeInfo,
+                                           MDS_BOOT_Result_t result, bool resume)
+{
+    // a failed install may leave a transfer in flight
+    if (g_bootUpgradeRead.dev != NULL) {
+        (void)MDS_BOOT_UpgradeReadWait(g_bootUpgradeRead.dev);
+    }
+    (void)BOOT_ProgramWait();
+
+    // a page that does not hold what was programmed is not resumed over, the install starts again
+    if ((result == MDS_BOOT_RESULT_EIO) && (g_bootUpgradeCheckpoint.mismatch)) {
+        result = MDS_BOOT_RESULT_EVERIFY;
+    }
+
+    if (swapInfo != NULL) {
+        // no package leaves the record of the last one, and the slot state with it, valid
+        if (ALGO_GetU32BE(upgradeInfo->magic) == MDS_BOOT_UPGRADE_MAGIC) {
+            swapInfo->magic = ALGO_GetU32BE(upgradeInfo->magic);
+            swapInfo->count = ALGO_GetU16BE(upgradeInfo->count);
+            swapInfo->size = ALGO_GetU32BE(upgradeInfo->size);
+            memcpy(swapInfo->hash, upgradeInfo->hash, sizeof(upgradeInfo->hash));
+        }
+
+        // a step left for later neither fails the upgrade nor ends it
+        swapInfo->result = result;
+        if ((result != MDS_BOOT_RESULT_SUCCESS) && (result != MDS_BOOT_RESULT_NONE) &&
+            (result != MDS_BOOT_RESULT_ECHECK) && (result != MDS_BOOT_RESULT_EAGAIN)) {
+            swapInfo->retry += 1;
+        } else if (result != MDS_BOOT_RESULT_EAGAIN) {
+            swapInfo->retry = 0;
+        }
+
+        // only an io failure or a step left for later may resume, anything else restarts from the first bin
+        if (((result != MDS_BOOT_RESULT_EIO) && (result != MDS_BOOT_RESULT_EAGAIN)) || (!resume)) {
+            memset(&(swapInfo->checkpoint), 0, sizeof(swapInfo->checkpoint));
+        }
+        BOOT_SwapInfoCommit(swapInfo);
+    }
+
+    memset(&g_bootUpgradeCheckpoint, 0, sizeof(g_bootUpgradeCheckpoint));
+    g_bootUpgradeStat.arenaSize = sizeof(g_bootUpgradeArena.buff);
+    g_bootUpgradeStat.arenaPeak = g_bootUpgradeArena.peak;
+    g_bootUpgradeArena.used = 0;
+#if (MDS_BOOT_WITH_TRACE > 0)
+    BOOT_TraceClose(result);
+#endif
+
+    return (result);
+}
+
+#if (MDS_BOOT_SAMPLE_NUM > 0)
+// digest of chunks spread evenly over the installed image, enough to notice an image changed since its install
+static MDS_BOOT_Result_t BOOT_InstallSample(MDS_BOOT_Device_t *dev, uint32_t size,
+                                            uint8_t sample[MDS_BOOT_CHKHASH_SIZE])
+{
+    MDS_BOOT_Digest_t ctx;
+    size_t mark = MDS_BOOT_ArenaMark();
+    uint8_t *buff = MDS_BOOT_ArenaAlloc(MDS_BOOT_CHECK_SIZE);
+    int res = ((buff == NULL) || (MDS_BOOT_DigestInit(&ctx) != 0)) ? (-1) : (0);
+
+    for (uint32_t i = 0; (res == 0) && (i < MDS_BOOT_SAMPLE_NUM); i++) {
+        uint32_t ofs = (uint32_t)(((uint64_t)(size) * i) / MDS_BOOT_SAMPLE_NUM);
+        size_t len = ((size - ofs) > MDS_BOOT_CHECK_SIZE) ? (MDS_BOOT_CHECK_SIZE) : (size - ofs);
+
+        res = MDS_BOOT_DeviceRead(dev, ofs, buff, len);
+        if (res == 0) {
+            res = MDS_BOOT_DigestUpdate(&ctx, buff, len);
+        }
+    }
+    if (res == 0) {
+        res = MDS_BOOT_DigestFinish(&ctx, sample);
+    }
+    MDS_BOOT_ArenaRelease(mark);
+
+    return ((res == 0) ? (MDS_BOOT_RESULT_SUCCESS) : (MDS_BOOT_RESULT_EIO));
+}
+#endif
+
+#if (defined(MDS_BOOT_WITH_VERIFY) && (MDS_BOOT_WITH_VERIFY > 0))
+// finish the image digest of ctx over the span from ofs on, read back from dev
+static MDS_BOOT_Result_t BOOT_InstallImage(MDS_BOOT_Device_t *dev, MDS_BOOT_Digest_t *ctx, uint32_t ofs,
+                                           uint32_t size, uint8_t image[MDS_BOOT_CHKHASH_SIZE])
+{
+    size_t mark = MDS_BOOT_ArenaMark();
+    uint8_t *buff = MDS_BOOT_ArenaAlloc(MDS_BOOT_CHECK_SIZE);
+    int res = (buff == NULL) ? (-1) : (0);
+
+    while ((res == 0) && (ofs < size)) {
+        size_t len = ((size - ofs) > MDS_BOOT_CHECK_SIZE) ? (MDS_BOOT_CHECK_SIZE) : (size - ofs);
+
+        res = MDS_BOOT_DeviceRead(dev, ofs, buff, len);
+        if (res == 0) {
+            res = MDS_BOOT_DigestUpdate(ctx, buff, len);
+        }
+        ofs += len;
+    }
+    if (res == 0) {
+        res = MDS_BOOT_DigestFinish(ctx, image);
+    }
+    MDS_BOOT_ArenaRelease(mark);
+
+    return ((res == 0) ? (MDS_BOOT_RESULT_SUCCESS) : (MDS_BOOT_RESULT_EIO));
+}
+#endif
+
+// the package is the one installed last into dev and only the erase of the source went missing
+static bool BOOT_InstallDone(const MDS_BOOT_SwapInfo_t *swapInfo, MDS_BOOT_Device_t *dev,
+                             const MDS_BOOT_UpgradeInfo_t *upgradeInfo)
+{
+    if ((swapInfo == NULL) || (dev == NULL) ||
+        (memcmp(swapInfo->install.hash, upgradeInfo->hash, sizeof(upgradeInfo->hash)) != 0)) {
+        return (false);
+    }
+
+#if (MDS_BOOT_SAMPLE_NUM > 0)
+    uint8_t sample[MDS_BOOT_CHKHASH_SIZE];
+
+    if ((BOOT_InstallSample(dev, swapInfo->install.size, sample) != MDS_BOOT_RESULT_SUCCESS) ||
+        (memcmp(swapInfo->install.sample, sample, sizeof(sample)) != 0)) {
+        return (false);
+    }
+#endif
+
+#if (defined(MDS_BOOT_WITH_VERIFY) && (MDS_BOOT_WITH_VERIFY > 0))
+    MDS_BOOT_Digest_t ctx;
+    uint8_t image[MDS_BOOT_CHKHASH_SIZE];
+
+    if ((MDS_BOOT_DigestInit(&ctx) != 0) ||
+        (BOOT_InstallImage(dev, &ctx, 0, swapInfo->install.size, image) != MDS_BOOT_RESULT_SUCCESS) ||
+        (memcmp(swapInfo->install.image, image, sizeof(image)) != 0)) {
+        return (false);
+    }
+#endif
+
+    return (true);
+}
+
+// dst stops holding the recorded image with its first write, so the record goes ahead of it, base is the image
+// of the other slot when dst is an inactive one and dst itself otherwise
+static void BOOT_InstallOpen(MDS_BOOT_SwapInfo_t *swapInfo, MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *base)
+{
+    static const MDS_BOOT_InstallInfo_t empty = {0};
+
+    g_bootUpgradeExtent.dev = dst;
+    g_bootUpgradeExtent.base = base;
+    g_bootUpgradeExtent.size = 0;
+#if (defined(MDS_BOOT_WITH_VERIFY) && (MDS_BOOT_WITH_VERIFY > 0))
+    g_bootUpgradeExtent.ofs = 0;
+    g_bootUpgradeExtent.follow = (MDS_BOOT_DigestInit(&(g_bootUpgradeExtent.image)) == 0);
+#endif
+
+    if ((swapInfo != NULL) && (memcmp(&(swapInfo->install), &empty, sizeof(empty)) != 0)) {
+        memset(&(swapInfo->install), 0, sizeof(swapInfo->install));
+        BOOT_SwapInfoCommit(swapInfo);
+    }
+}
+
+// a stepped install takes its extent back every step, the image digest is then read back at the close
+static void BOOT_InstallResume(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *base, uintptr_t size)
+{
+    g_bootUpgradeExtent.dev = dst;
+    g_bootUpgradeExtent.base = base;
+    g_bootUpgradeExtent.size = size;
+#if (defined(MDS_BOOT_WITH_VERIFY) && (MDS_BOOT_WITH_VERIFY > 0))
+    g_bootUpgradeExtent.ofs = 0;
+    g_bootUpgradeExtent.follow = false;
 #endif
+}
 
-/* Variable ---------------------------------------------------------------- */
-static __attribute__((used, section(MDS_BOOT_SWAP_SECTION))) MDS_BOOT_SwapInfo_t g_bootSwapInfo;
-static MDS_BOOT_UpgradeInfo_t g_bootUpgradeInfo = {0};
-static uint8_t g_bootCheckBuff[MDS_BOOT_CHECK_SIZE];
-static const MDS_BOOT_UpgradeOps_t *g_bootUpgradeOps = NULL;
+// a resumed install only spans the writes since the resume, partitions routed off dst are not sampled
+static void BOOT_InstallClose(MDS_BOOT_SwapInfo_t *swapInfo, MDS_BOOT_Device_t *dst,
+                              const MDS_BOOT_UpgradeInfo_t *upgradeInfo)
+{
+    MDS_BOOT_InstallInfo_t *install = (swapInfo != NULL) ? (&(swapInfo->install)) : (NULL);
+    struct BOOT_UpgradeExtent *extent = &g_bootUpgradeExtent;
 
-/* Function ---------------------------------------------------------------- */
-int MDS_BOOT_DeviceRead(MDS_BOOT_Device_t *dev, uintptr_t ofs, uint8_t *buff, size_t size)
+    extent->dev = NULL;
+    if (install == NULL) {
+        return;
+    }
+
+    install->size = (uint32_t)((dst->size > 0) ? (dst->size) : (extent->size));
+#if (MDS_BOOT_SAMPLE_NUM > 0)
+    if (BOOT_InstallSample(dst, install->size, install->sample) != MDS_BOOT_RESULT_SUCCESS) {
+        return;  // no record, the package is installed again while the source is left
+    }
+#endif
+#if (defined(MDS_BOOT_WITH_VERIFY) && (MDS_BOOT_WITH_VERIFY > 0))
+    // the digest taken along the writes only holds while they landed in order from the start of the span,
+    // it is read back for the rest of the span and taken over the whole span otherwise
+    if ((!extent->follow) || (extent->ofs > install->size)) {
+        extent->ofs = 0;
+        if (MDS_BOOT_DigestInit(&(extent->image)) != 0) {
+            return;
+        }
+    }
+    if (BOOT_InstallImage(dst, &(extent->image), (uint32_t)(extent->ofs), install->size, install->image) !=
+        MDS_BOOT_RESULT_SUCCESS) {
+        return;
+    }
+#endif
+    memcpy(install->hash, upgradeInfo->hash, sizeof(upgradeInfo->hash));
+}
+
+// installed is the device holding the image of the last install, a package matching it is dropped unverified
+static MDS_BOOT_Result_t BOOT_UpgradeInstall(MDS_BOOT_SwapInfo_t *swapInfo, MDS_BOOT_Device_t *dst,
+                                             MDS_BOOT_Device_t *installed, MDS_BOOT_Device_t *src,
+                                             MDS_BOOT_UpgradeInfo_t *upgradeInfo)
 {
-    if ((g_bootUpgradeOps != NULL) && (g_bootUpgradeOps->read != NULL)) {
-        return (g_bootUpgradeOps->read(dev, ofs, buff, size));
+    MDS_BOOT_Result_t result = BOOT_CheckUpgradeHeader(src, 0, upgradeInfo);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
     }
 
-    return (MDS_BOOT_RESULT_EIO);
+    if (BOOT_InstallDone(swapInfo, installed, upgradeInfo)) {
+        MDS_BOOT_DeviceErase(src);
+        return (MDS_BOOT_RESULT_NONE);
+    }
+
+    // fused writes land ahead of the digests, so only an inactive slot that is switched to on success takes them,
+    // bins routed to partitions off the slot are checked first
+    if ((MDS_BOOT_WITH_FUSED > 0) && (installed != dst) && (g_bootPartitionTable == NULL)) {
+        result = BOOT_CheckBinBuffer(dst, src, sizeof(*upgradeInfo), upgradeInfo);
+        if (result != MDS_BOOT_RESULT_SUCCESS) {
+            return (result);
+        }
+
+        BOOT_InstallOpen(swapInfo, dst, installed);
+        BOOT_CheckpointOpen(swapInfo, upgradeInfo, sizeof(*upgradeInfo));
+        result = BOOT_UpgradeFused(dst, src, sizeof(*upgradeInfo), upgradeInfo);
+    } else {
+        result = BOOT_CheckHash(src, sizeof(*upgradeInfo), ALGO_GetU32BE(upgradeInfo->size), upgradeInfo->hash);
+        if (result == MDS_BOOT_RESULT_SUCCESS) {
+            result = BOOT_CheckAllBinInfo(src, sizeof(*upgradeInfo), upgradeInfo);
+        }
+        if (result == MDS_BOOT_RESULT_SUCCESS) {
+            result = BOOT_CheckBinBuffer(dst, src, sizeof(*upgradeInfo), upgradeInfo);
+        }
+        if (result != MDS_BOOT_RESULT_SUCCESS) {
+            return (result);
+        }
+
+        BOOT_InstallOpen(swapInfo, dst, installed);
+        BOOT_CheckpointOpen(swapInfo, upgradeInfo, sizeof(*upgradeInfo));
+        result = BOOT_UpgradeBinInfo(dst, src, sizeof(*upgradeInfo), upgradeInfo);
+    }
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        BOOT_InstallClose(swapInfo, dst, upgradeInfo);
+    }
+    if ((result == MDS_BOOT_RESULT_SUCCESS) || (result == MDS_BOOT_RESULT_NONE)) {
+        MDS_BOOT_DeviceErase(src);
+    }
+
+    return (result);
 }
 
-int MDS_BOOT_DeviceWrite(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *buff, size_t size)
+MDS_BOOT_Result_t MDS_BOOT_UpgradeCheck(MDS_BOOT_SwapInfo_t *swapInfo, MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src,
+                                        const MDS_BOOT_UpgradeOps_t *ops)
 {
-    if ((g_bootUpgradeOps != NULL) && (g_bootUpgradeOps->write != NULL)) {
-        return (g_bootUpgradeOps->write(dev, ofs, buff, size));
+    MDS_BOOT_UpgradeInfo_t *upgradeInfo = &g_bootUpgradeInfo;
+    MDS_BOOT_Result_t result = BOOT_UpgradeOpen(swapInfo, ops);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
     }
 
-    return (MDS_BOOT_RESULT_EIO);
+    result = BOOT_UpgradeInstall(swapInfo, dst, dst, src, upgradeInfo);
+
+    return (BOOT_UpgradeClose(swapInfo, upgradeInfo, result, true));
 }
 
-int MDS_BOOT_DeviceErase(MDS_BOOT_Device_t *dev)
+// the switch is committed along with the result of the upgrade
+static void BOOT_SlotSwitch(MDS_BOOT_SwapInfo_t *swapInfo, uint8_t next)
+{
+    swapInfo->slot.previous = swapInfo->slot.active;
+    swapInfo->slot.active = next;
+    swapInfo->slot.trial = MDS_BOOT_SLOT_TRIAL;
+    swapInfo->slot.state = MDS_BOOT_SLOT_PENDING;
+}
+
+// install into the inactive slot and switch to it in the same swap info commit that records the result
+MDS_BOOT_Result_t MDS_BOOT_UpgradeSlot(MDS_BOOT_SwapInfo_t *swapInfo, MDS_BOOT_Device_t *slot[MDS_BOOT_SLOT_NUM],
+                                       MDS_BOOT_Device_t *src, const MDS_BOOT_UpgradeOps_t *ops)
 {
-    if ((g_bootUpgradeOps != NULL) && (g_bootUpgradeOps->erase != NULL)) {
-        return (g_bootUpgradeOps->erase(dev));
+    MDS_BOOT_UpgradeInfo_t *upgradeInfo = &g_bootUpgradeInfo;
+
+    // while the active image is on trial the inactive slot holds the only one known good
+    if ((swapInfo == NULL) || (slot == NULL) || (swapInfo->slot.state == MDS_BOOT_SLOT_PENDING)) {
+        return (MDS_BOOT_RESULT_NONE);
     }
 
-    return (MDS_BOOT_RESULT_EIO);
+    uint8_t next = (uint8_t)((swapInfo->slot.active + 1) % MDS_BOOT_SLOT_NUM);
+    MDS_BOOT_Result_t result = BOOT_UpgradeOpen(swapInfo, ops);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
+    }
+
+    // a package rolled back once is dropped instead of installed again
+    if ((swapInfo->slot.state == MDS_BOOT_SLOT_ROLLBACK) &&
+        (BOOT_CheckUpgradeHeader(src, 0, upgradeInfo) == MDS_BOOT_RESULT_SUCCESS) &&
+        (memcmp(swapInfo->hash, upgradeInfo->hash, sizeof(swapInfo->hash)) == 0)) {
+        MDS_BOOT_DeviceErase(src);
+        result = MDS_BOOT_RESULT_ECHECK;
+    } else {
+        result = BOOT_UpgradeInstall(swapInfo, slot[next], slot[swapInfo->slot.active], src, upgradeInfo);
+    }
+
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        BOOT_SlotSwitch(swapInfo, next);
+    }
+
+    return (BOOT_UpgradeClose(swapInfo, upgradeInfo, result, true));
 }
 
-static MDS_BOOT_Result_t BOOT_CheckHash(MDS_BOOT_Device_t *src, uint32_t srcOfs, uint32_t size,
-                                        uint8_t hash[MDS_BOOT_CHKHASH_SIZE])
+// slot to start, an image not confirmed within its trial boots is rolled back to the previous slot
+uint8_t MDS_BOOT_SlotSelect(MDS_BOOT_SwapInfo_t *swapInfo)
 {
-    ALGO_SHA256_Context_t ctx;
-    ALGO_SHA256_Digest_t digest;
+    MDS_BOOT_SlotInfo_t *slot = &(swapInfo->slot);
 
-    ALGO_SHA256_Init(&ctx);
+    if ((slot->active >= MDS_BOOT_SLOT_NUM) || (slot->previous >= MDS_BOOT_SLOT_NUM) ||
+        (slot->state > MDS_BOOT_SLOT_ROLLBACK)) {
+        memset(slot, 0, sizeof(*slot));
+    }
 
-    while (size > 0) {
-        size_t len = (size > sizeof(g_bootCheckBuff)) ? (sizeof(g_bootCheckBuff)) : (size);
-        int res = MDS_BOOT_DeviceRead(src, srcOfs, g_bootCheckBuff, len);
-        if (res != 0) {
-            return (MDS_BOOT_RESULT_EIO);
+    if (slot->state == MDS_BOOT_SLOT_PENDING) {
+        if (slot->trial == 0) {
+            slot->active = slot->previous;
+            slot->state = MDS_BOOT_SLOT_ROLLBACK;
+            memset(&(swapInfo->install), 0, sizeof(swapInfo->install));  // it describes the slot left
+        } else {
+            slot->trial -= 1;
         }
-        ALGO_SHA256_Update(&ctx, g_bootCheckBuff, len);
-        srcOfs += len;
-        size -= len;
+        BOOT_SwapInfoCommit(swapInfo);
     }
 
-    ALGO_SHA256_Finish(&ctx, &digest);
+    return (slot->active);
+}
 
-    if (memcmp(hash, digest.hash, sizeof(digest.hash)) != 0) {
-        return (MDS_BOOT_RESULT_ECHECK);
+void MDS_BOOT_SlotConfirm(MDS_BOOT_SwapInfo_t *swapInfo)
+{
+    if (swapInfo->slot.state == MDS_BOOT_SLOT_PENDING) {
+        swapInfo->slot.trial = 0;
+        swapInfo->slot.state = MDS_BOOT_SLOT_CONFIRMED;
+        BOOT_SwapInfoCommit(swapInfo);
     }
+}
 
-    return (MDS_BOOT_RESULT_SUCCESS);
+void MDS_BOOT_UpgradeStepOpen(MDS_BOOT_UpgradeStep_t *step, MDS_BOOT_SwapInfo_t *swapInfo,
+                              MDS_BOOT_Device_t *slot[MDS_BOOT_SLOT_NUM], MDS_BOOT_Device_t *src,
+                              const MDS_BOOT_UpgradeOps_t *ops)
+{
+    memset(step, 0, sizeof(*step));
+    step->swapInfo = swapInfo;
+    for (size_t i = 0; (slot != NULL) && (i < MDS_BOOT_SLOT_NUM); i++) {
+        step->slot[i] = slot[i];
+    }
+    step->src = src;
+    step->ops = ops;
 }
 
-static MDS_BOOT_Result_t BOOT_CheckUpgradeInfo(MDS_BOOT_Device_t *src, uint32_t srcOfs,
-                                               MDS_BOOT_UpgradeInfo_t *upgradeInfo)
+static MDS_BOOT_Result_t BOOT_StepOpen(MDS_BOOT_UpgradeStep_t *step)
 {
-    int res = MDS_BOOT_DeviceRead(src, srcOfs, (uint8_t *)(upgradeInfo), sizeof(*upgradeInfo));
-    if (res != 0) {
-        return (MDS_BOOT_RESULT_NONE);  // jump to application
+    MDS_BOOT_SwapInfo_t *swapInfo = step->swapInfo;
+    MDS_BOOT_UpgradeInfo_t *upgradeInfo = &(step->upgradeInfo);
+    MDS_BOOT_Result_t result = BOOT_CheckUpgradeHeader(step->src, 0, upgradeInfo);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
     }
 
-    if (ALGO_GetU32BE(upgradeInfo->magic) != MDS_BOOT_UPGRADE_MAGIC) {
+    // a package rolled back once is dropped instead of installed again
+    if ((swapInfo->slot.state == MDS_BOOT_SLOT_ROLLBACK) &&
+        (memcmp(swapInfo->hash, upgradeInfo->hash, sizeof(swapInfo->hash)) == 0)) {
+        MDS_BOOT_DeviceErase(step->src);
         return (MDS_BOOT_RESULT_ECHECK);
     }
 
-    uint16_t check = ALGO_CRC16(0, (uint8_t *)(&(upgradeInfo->magic)),
-                                sizeof(*upgradeInfo) - sizeof(upgradeInfo->check));
-    if (check != ALGO_GetU16BE(upgradeInfo->check)) {
+    if (BOOT_InstallDone(swapInfo, step->slot[swapInfo->slot.active], upgradeInfo)) {
+        MDS_BOOT_DeviceErase(step->src);
+        return (MDS_BOOT_RESULT_NONE);
+    }
+
+    // the checkpoint left by another package must not be resumed once the swap info names this one
+    BOOT_CheckpointOpen(swapInfo, upgradeInfo, sizeof(*upgradeInfo));
+    step->state = MDS_BOOT_STEP_CHECK;
+    step->index = 0;
+    step->ofs = sizeof(*upgradeInfo);
+    step->binEnd = 0;
+    step->size = 0;
+
+    return ((MDS_BOOT_DigestInit(&(step->total)) == 0) ? (MDS_BOOT_RESULT_EAGAIN) : (MDS_BOOT_RESULT_EIO));
+}
+
+// a step picks its bin up at the checkpoint, a plain lzma stream or a patch would be decoded again from its start
+static bool BOOT_StepResumable(uint16_t flag)
+{
+    flag &= (uint16_t)(~MDS_BOOT_FLAG_CRYPT);
+
+    return ((flag == MDS_BOOT_FLAG_COPY) || (flag == MDS_BOOT_FLAG_LZMA_BLOCK) || (flag == MDS_BOOT_FLAG_LZ4));
+}
+
+static MDS_BOOT_Result_t BOOT_StepBin(MDS_BOOT_UpgradeStep_t *step, uint32_t endOfs)
+{
+    MDS_BOOT_BinInfo_t *binInfo = &(step->binInfo);
+
+    if ((endOfs - step->ofs) < sizeof(*binInfo)) {
+        return (MDS_BOOT_RESULT_ECHECK);
+    } else if (MDS_BOOT_DeviceRead(step->src, step->ofs, (uint8_t *)(binInfo), sizeof(*binInfo)) != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    uint16_t check = MDS_BOOT_Crc16(0, (uint8_t *)(&(binInfo->flag)), sizeof(*binInfo) - sizeof(binInfo->check));
+    uint32_t srcSize = ALGO_GetU32BE(binInfo->srcSize);
+    if ((check != ALGO_GetU16BE(binInfo->check)) || (srcSize > (endOfs - step->ofs - sizeof(*binInfo))) ||
+        (!BOOT_StepResumable(ALGO_GetU16BE(binInfo->flag)))) {
         return (MDS_BOOT_RESULT_ECHECK);
     }
 
-    return (BOOT_CheckHash(src, sizeof(*upgradeInfo), ALGO_GetU32BE(upgradeInfo->size), upgradeInfo->hash));
+    if ((MDS_BOOT_DigestUpdate(&(step->total), (uint8_t *)(binInfo), sizeof(*binInfo)) != 0) ||
+        (MDS_BOOT_DigestInit(&(step->bin)) != 0)) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+    step->ofs += sizeof(*binInfo);
+    step->binEnd = step->ofs + srcSize;
+
+    return (MDS_BOOT_RESULT_SUCCESS);
 }
 
-static MDS_BOOT_Result_t BOOT_CheckAllBinInfo(MDS_BOOT_Device_t *src, size_t srcOfs,
-                                              const MDS_BOOT_UpgradeInfo_t *upgradeInfo)
+// one pass over the package feeds its digest and the digest of the bin each byte belongs to
+static MDS_BOOT_Result_t BOOT_StepCheck(MDS_BOOT_UpgradeStep_t *step, MDS_BOOT_Device_t *dst, size_t budget)
 {
-    MDS_BOOT_Result_t result = MDS_BOOT_RESULT_SUCCESS;
-    uint16_t cnt = ALGO_GetU16BE(upgradeInfo->count);
+    MDS_BOOT_UpgradeInfo_t *upgradeInfo = &(step->upgradeInfo);
+    uint32_t endOfs = sizeof(*upgradeInfo) + ALGO_GetU32BE(upgradeInfo->size);
+    uint8_t sum[MDS_BOOT_CHKHASH_SIZE];
+    size_t mark = MDS_BOOT_ArenaMark();
+    uint8_t *buff = MDS_BOOT_ArenaAlloc(MDS_BOOT_CHECK_SIZE);
+    if (buff == NULL) {
+        return (MDS_BOOT_RESULT_ENOMEM);
+    }
 
-    for (uint16_t i = 0; i < cnt; i++) {
-        MDS_BOOT_BinInfo_t binInfo = {0};
+    for (size_t done = 0; ((budget == 0) || (done < budget)) && (step->ofs < endOfs);) {
+        if ((step->binEnd == 0) && (step->index < ALGO_GetU16BE(upgradeInfo->count))) {
+            MDS_BOOT_Result_t result = BOOT_StepBin(step, endOfs);
+            if (result != MDS_BOOT_RESULT_SUCCESS) {
+                return (result);
+            }
+            done += sizeof(step->binInfo);
+            continue;
+        }
 
-        int res = MDS_BOOT_DeviceRead(src, srcOfs, (uint8_t *)(&binInfo), sizeof(binInfo));
-        if (res != 0) {
+        uint32_t end = (step->binEnd > 0) ? (step->binEnd) : (endOfs);
+        size_t len = ((end - step->ofs) > MDS_BOOT_CHECK_SIZE) ? (MDS_BOOT_CHECK_SIZE) : (end - step->ofs);
+        if ((MDS_BOOT_DeviceRead(step->src, step->ofs, buff, len) != 0) ||
+            (MDS_BOOT_DigestUpdate(&(step->total), buff, len) != 0) ||
+            ((step->binEnd > 0) && (MDS_BOOT_DigestUpdate(&(step->bin), buff, len) != 0))) {
             return (MDS_BOOT_RESULT_EIO);
         }
+        step->ofs += len;
+        done += len;
 
-        uint16_t check = ALGO_CRC16(0, (uint8_t *)(&(binInfo.flag)), sizeof(binInfo) - sizeof(binInfo.check));
-        if (check != ALGO_GetU16BE(binInfo.check)) {
-            return (MDS_BOOT_RESULT_ECHECK);
+        if ((step->binEnd > 0) && (step->ofs == step->binEnd)) {
+            if (MDS_BOOT_DigestFinish(&(step->bin), sum) != 0) {
+                return (MDS_BOOT_RESULT_EIO);
+            } else if (memcmp(step->binInfo.hash, sum, sizeof(sum)) != 0) {
+                return (MDS_BOOT_RESULT_ECHECK);
+            }
+            step->binEnd = 0;
+            step->index += 1;
         }
+    }
 
-        uint32_t srcSize = ALGO_GetU32BE(binInfo.srcSize);
-        result = BOOT_CheckHash(src, srcOfs + sizeof(binInfo), srcSize, binInfo.hash);
-        if (result != MDS_BOOT_RESULT_SUCCESS) {
-            break;
-        }
+    if (step->ofs < endOfs) {
+        return (MDS_BOOT_RESULT_EAGAIN);
+    } else if (MDS_BOOT_DigestFinish(&(step->total), sum) != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    } else if ((step->index < ALGO_GetU16BE(upgradeInfo->count)) ||
+               (memcmp(upgradeInfo->hash, sum, sizeof(sum)) != 0)) {
+        return (MDS_BOOT_RESULT_ECHECK);
+    }
 
-        srcOfs += sizeof(binInfo) + srcSize;
+    MDS_BOOT_ArenaRelease(mark);
+    MDS_BOOT_Result_t result = BOOT_CheckBinBuffer(dst, step->src, sizeof(*upgradeInfo), upgradeInfo);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
     }
 
-    return (result);
+    // the install record is cleared and committed once, the install steps only take back the extent
+    BOOT_InstallOpen(step->swapInfo, dst, step->slot[step->swapInfo->slot.active]);
+    step->state = MDS_BOOT_STEP_INSTALL;
+
+    return (MDS_BOOT_RESULT_EAGAIN);
 }
 
-static MDS_BOOT_Result_t BOOT_UpgradeSwtich(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
-                                            uint32_t srcSize, uint16_t flag)
+// every step resumes the install from the checkpoint and leaves it at the first commit past its budget
+static MDS_BOOT_Result_t BOOT_StepInstall(MDS_BOOT_UpgradeStep_t *step, MDS_BOOT_Device_t *dst, size_t budget)
 {
-    MDS_BOOT_Result_t result = MDS_BOOT_RESULT_NONE;
+    MDS_BOOT_UpgradeInfo_t *upgradeInfo = &(step->upgradeInfo);
 
-    switch (flag) {
-#if (defined(MDS_BOOT_WITH_COPY) && (MDS_BOOT_WITH_COPY > 0))
-        case MDS_BOOT_FLAG_COPY:
-            result = MDS_BOOT_UpgradeCopy(dst, src, srcOfs, srcSize);
-            break;
-#endif
-#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
-        case MDS_BOOT_FLAG_LZMA:
-            result = MDS_BOOT_UpgradeLzma(dst, src, srcOfs, srcSize);
-            break;
-#endif
-        default:
-            break;
+    BOOT_InstallResume(dst, step->slot[step->swapInfo->slot.active], step->size);
+    BOOT_CheckpointOpen(step->swapInfo, upgradeInfo, sizeof(*upgradeInfo));
+    g_bootUpgradeCheckpoint.budget = budget;
+    MDS_BOOT_Result_t result = BOOT_UpgradeBinInfo(dst, step->src, sizeof(*upgradeInfo), upgradeInfo);
+    step->size = (uint32_t)(g_bootUpgradeExtent.size);
+    if ((result != MDS_BOOT_RESULT_SUCCESS) && (g_bootUpgradeCheckpoint.yield)) {
+        return (MDS_BOOT_RESULT_EAGAIN);
+    }
+
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        BOOT_InstallClose(step->swapInfo, dst, upgradeInfo);
+        MDS_BOOT_DeviceErase(step->src);
     }
 
     return (result);
 }
 
-static MDS_BOOT_Result_t BOOT_UpgradeBinInfo(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, size_t srcOfs,
-                                             const MDS_BOOT_UpgradeInfo_t *upgradeInfo)
+// a bounded piece of MDS_BOOT_UpgradeSlot from the application, EAGAIN until the inactive slot is installed and
+// switched to for the next boot, budget is the bytes a step hashes or writes and 0 runs to the end, only copy,
+// lzma block and lz4 bins resume where the last step left them and any other bin fails the check
+MDS_BOOT_Result_t MDS_BOOT_UpgradeStep(MDS_BOOT_UpgradeStep_t *step, size_t budget)
 {
-    uint16_t cnt = ALGO_GetU16BE(upgradeInfo->count);
+    MDS_BOOT_SwapInfo_t *swapInfo = step->swapInfo;
 
-    for (uint16_t i = 0; i < cnt; i++) {
-        MDS_BOOT_BinInfo_t binInfo = {0};
+    if (step->state == MDS_BOOT_STEP_DONE) {
+        return (step->result);
+    }
 
-        int res = MDS_BOOT_DeviceRead(src, srcOfs, (uint8_t *)(&binInfo), sizeof(binInfo));
-        if (res != 0) {
-            return (MDS_BOOT_RESULT_EIO);
-        }
+    // while the active image is on trial the inactive slot holds the only one known good
+    if ((swapInfo == NULL) || (step->slot[0] == NULL) || (step->slot[1] == NULL) ||
+        (swapInfo->slot.state == MDS_BOOT_SLOT_PENDING)) {
+        return (MDS_BOOT_RESULT_NONE);
+    }
 
-        uint16_t flag = ALGO_GetU16BE(binInfo.flag);
-        uint32_t srcSize = ALGO_GetU32BE(binInfo.srcSize);
-        MDS_BOOT_Result_t result = BOOT_UpgradeSwtich(dst, src, srcOfs + sizeof(binInfo), srcSize, flag);
-        if (result != MDS_BOOT_RESULT_SUCCESS) {
-            return (result);
-        }
+    uint8_t next = (uint8_t)((swapInfo->slot.active + 1) % MDS_BOOT_SLOT_NUM);
+    MDS_BOOT_Result_t result = BOOT_UpgradeOpen(swapInfo, step->ops);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
+    }
 
-        srcOfs += sizeof(binInfo) + srcSize;
+    if (step->state == MDS_BOOT_STEP_OPEN) {
+        result = BOOT_StepOpen(step);
+    } else if (step->state == MDS_BOOT_STEP_CHECK) {
+        result = BOOT_StepCheck(step, step->slot[next], budget);
+    } else {
+        result = BOOT_StepInstall(step, step->slot[next], budget);
     }
 
-    return (MDS_BOOT_RESULT_SUCCESS);
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        BOOT_SlotSwitch(swapInfo, next);
+    }
+    result = BOOT_UpgradeClose(swapInfo, &(step->upgradeInfo), result, true);
+    if (result != MDS_BOOT_RESULT_EAGAIN) {
+        step->state = MDS_BOOT_STEP_DONE;
+        step->result = result;
+    }
+
+    return (result);
 }
 
-MDS_BOOT_Result_t MDS_BOOT_UpgradeCheck(MDS_BOOT_SwapInfo_t *swapInfo, MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src,
-                                        const MDS_BOOT_UpgradeOps_t *ops)
+// the package arrives once and in order, a gap is pulled and dropped, nothing behind the stream comes back
+static int BOOT_StreamRead(MDS_BOOT_Device_t *dev, uintptr_t ofs, uint8_t *data, size_t len)
 {
-    if (ops == NULL) {
-        return (MDS_BOOT_RESULT_NONE);
+    struct BOOT_UpgradeStream *stream = (struct BOOT_UpgradeStream *)(dev->arg);
+
+    if ((ofs < stream->pos) || (stream->stream->pull == NULL)) {
+        return (MDS_BOOT_RESULT_EIO);
     }
 
-    if ((swapInfo != NULL) && (swapInfo->retry >= MDS_BOOT_UPGRADE_RETRY)) {
-        return (MDS_BOOT_RESULT_ERETRY);
+    while ((len > 0) && (stream->pos < ofs)) {
+        size_t gap = ((ofs - stream->pos) > len) ? (len) : (ofs - stream->pos);
+        if (stream->stream->pull(stream->stream->arg, data, gap) != 0) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+        stream->pos += gap;
     }
 
-    MDS_BOOT_Result_t result;
-    MDS_BOOT_UpgradeInfo_t *upgradeInfo = &g_bootUpgradeInfo;
-    g_bootUpgradeOps = ops;
+    if ((len > 0) && (stream->stream->pull(stream->stream->arg, data, len) != 0)) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+    stream->pos = ofs + len;
 
-    do {
-        result = BOOT_CheckUpgradeInfo(src, 0, upgradeInfo);
-        if (result != MDS_BOOT_RESULT_SUCCESS) {
-            break;
-        }
+    return (0);
+}
 
-        result = BOOT_CheckAllBinInfo(src, sizeof(*upgradeInfo), upgradeInfo);
-        if (result != MDS_BOOT_RESULT_SUCCESS) {
-            break;
-        }
+static const MDS_BOOT_UpgradeOps_t G_BOOT_STREAM_OPS = {
+    .read = BOOT_StreamRead,
+};
 
-        result = BOOT_UpgradeBinInfo(dst, src, sizeof(*upgradeInfo), upgradeInfo);
-        if ((result == MDS_BOOT_RESULT_SUCCESS) || (result == MDS_BOOT_RESULT_NONE)) {
-            MDS_BOOT_DeviceErase(src);
-        }
-    } while (0);
+// hash while installing into the inactive slot and switch to it once every digest matched, a stream is neither
+// checked ahead nor resumed, partitions off the slot would be written unchecked and lzma block bins read their table
+// again between blocks, both need a device
+MDS_BOOT_Result_t MDS_BOOT_UpgradeStream(MDS_BOOT_SwapInfo_t *swapInfo, MDS_BOOT_Device_t *slot[MDS_BOOT_SLOT_NUM],
+                                         const MDS_BOOT_Stream_t *stream, const MDS_BOOT_UpgradeOps_t *ops)
+{
+    MDS_BOOT_UpgradeInfo_t *upgradeInfo = &g_bootUpgradeInfo;
 
-    if (swapInfo != NULL) {
-        swapInfo->magic = ALGO_GetU32BE(upgradeInfo->magic);
-        swapInfo->count = ALGO_GetU16BE(upgradeInfo->count);
-        swapInfo->size = ALGO_GetU32BE(upgradeInfo->size);
-        memcpy(swapInfo->hash, upgradeInfo->hash, sizeof(upgradeInfo->hash));
+    // while the active image is on trial the inactive slot holds the only one known good
+    if ((swapInfo == NULL) || (slot == NULL) || (stream == NULL) || (g_bootPartitionTable != NULL) ||
+        (swapInfo->slot.state == MDS_BOOT_SLOT_PENDING)) {
+        return (MDS_BOOT_RESULT_NONE);
+    }
 
-        swapInfo->result = result;
-        if ((result != MDS_BOOT_RESULT_SUCCESS) && (result != MDS_BOOT_RESULT_NONE) &&
-            (result != MDS_BOOT_RESULT_ECHECK)) {
-            swapInfo->retry += 1;
-        } else {
-            swapInfo->retry = 0;
-        }
-        swapInfo->check = ALGO_CRC16(0, (uint8_t *)(&(swapInfo->magic)), sizeof(*swapInfo) - sizeof(swapInfo->check));
+    uint8_t next = (uint8_t)((swapInfo->slot.active + 1) % MDS_BOOT_SLOT_NUM);
+    MDS_BOOT_Result_t result = BOOT_UpgradeOpen(swapInfo, ops);
+    if (result != MDS_BOOT_RESULT_SUCCESS) {
+        return (result);
     }
 
-    return (result);
+    g_bootUpgradeStream.stream = stream;
+    g_bootUpgradeStream.pos = 0;
+    g_bootUpgradeStream.device = (MDS_BOOT_Device_t){.arg = &g_bootUpgradeStream, .ops = &G_BOOT_STREAM_OPS};
+
+    result = BOOT_CheckUpgradeHeader(&(g_bootUpgradeStream.device), 0, upgradeInfo);
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        BOOT_InstallOpen(swapInfo, slot[next], slot[swapInfo->slot.active]);
+        BOOT_CheckpointOpen(NULL, upgradeInfo, sizeof(*upgradeInfo));
+        result = BOOT_UpgradeFused(slot[next], &(g_bootUpgradeStream.device), sizeof(*upgradeInfo), upgradeInfo);
+    }
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        BOOT_InstallClose(swapInfo, slot[next], upgradeInfo);
+        BOOT_SlotSwitch(swapInfo, next);
+    }
+
+    return (BOOT_UpgradeClose(swapInfo, upgradeInfo, result, false));
 }
 
 MDS_BOOT_SwapInfo_t *MDS_BOOT_GetSwapInfo(void)
 {
-    MDS_BOOT_SwapInfo_t *swapInfo = &g_bootSwapInfo;
+    MDS_BOOT_SwapInfo_t *swapInfo = &(g_bootSwapSection.swapInfo);
 
-    if ((swapInfo->magic != MDS_BOOT_UPGRADE_MAGIC) ||
-        (swapInfo->check !=
-         ALGO_CRC16(0, (uint8_t *)(&(swapInfo->magic)), sizeof(*swapInfo) - sizeof(swapInfo->check)))) {
+    if ((swapInfo->magic != MDS_BOOT_UPGRADE_MAGIC) || (swapInfo->check != BOOT_SwapInfoCheck(swapInfo))) {
         memset(swapInfo, 0, sizeof(*swapInfo));
     }
 
     return (swapInfo);
 }
 
-MDS_BOOT_Result_t MDS_BOOT_UpgradeCopy(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
-                                       uint32_t srcSize)
+const MDS_BOOT_UpgradeStat_t *MDS_BOOT_GetUpgradeStat(void)
 {
-    int res = MDS_BOOT_DeviceErase(dst);
-    if (res != 0) {
-        return (MDS_BOOT_RESULT_EIO);
-    }
+    return (&g_bootUpgradeStat);
+}
+
+void MDS_BOOT_SetStageDevice(MDS_BOOT_Device_t *stage)
+{
+    g_bootStageDevice = stage;
+}
+
+MDS_BOOT_Device_t *MDS_BOOT_GetStageDevice(void)
+{
+    return (g_bootStageDevice);
+}
+
+// route every bin by dstAddr to its partition, without a table all bins go to the dst of the upgrade check
+void MDS_BOOT_SetPartitionTable(const MDS_BOOT_Partition_t *table, uint16_t count)
+{
+    g_bootPartitionTable = (count > 0) ? (table) : (NULL);
+    g_bootPartitionCount = count;
+}
+
+// install bins of further flags, or replace a built-in codec, without touching the bootloader
+void MDS_BOOT_SetCodecTable(const MDS_BOOT_Codec_t *table, uint16_t count)
+{
+    g_bootCodecTable = (count > 0) ? (table) : (NULL);
+    g_bootCodecCount = count;
+}
+
+void MDS_BOOT_SetDigestOps(const MDS_BOOT_DigestOps_t *ops)
+{
+    g_bootDigestOps = ops;
+}
+
+void MDS_BOOT_SetCryptOps(const MDS_BOOT_CryptOps_t *ops)
+{
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+    g_bootCryptOps = ops;
+#else
+    (void)(ops);
+#endif
+}
+
+static MDS_BOOT_Result_t BOOT_UpgradeCopyStream(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                                uint32_t srcSize, uint32_t dstOfs, uint8_t *buff[])
+{
+    int res;
 
     uint32_t readOfs = 0;
-    while (readOfs < srcSize) {
-        size_t single = ((srcSize - readOfs) > sizeof(g_bootCheckBuff)) ? (sizeof(g_bootCheckBuff))
-                                                                        : (srcSize - readOfs);
+    for (size_t idx = 0, pending = 0; readOfs < srcSize; idx = (idx + 1) % MDS_BOOT_BUFF_NUM) {
+        size_t single = ((srcSize - readOfs) > MDS_BOOT_CHECK_SIZE) ? (MDS_BOOT_CHECK_SIZE) : (srcSize - readOfs);
+
+        // skip chunks committed before the last power loss
+        if ((dstOfs + readOfs + single) <= g_bootUpgradeCheckpoint.resumeOfs) {
+            res = MDS_BOOT_UpgradeSkip(src, srcOfs + readOfs, single);
+            if (res != 0) {
+                return (MDS_BOOT_RESULT_EIO);
+            }
+            readOfs += single;
+            continue;
+        }
 
-        res = MDS_BOOT_DeviceRead(src, srcOfs + readOfs, g_bootCheckBuff, single);
+        // a mapped source is programmed straight from memory, in checkpoint steps to keep resume granularity
+        const uint8_t *data = MDS_BOOT_UpgradeMap(src, srcOfs + readOfs, srcSize - readOfs);
+        for (; (data != NULL) && (readOfs < srcSize); readOfs += single) {
+            single = ((srcSize - readOfs) > MDS_BOOT_CHECKPOINT_SIZE) ? (MDS_BOOT_CHECKPOINT_SIZE)
+                                                                      : (srcSize - readOfs);
+            res = MDS_BOOT_UpgradeWrite(dst, dstOfs + readOfs, data, single);
+            if (res != 0) {
+                return (MDS_BOOT_RESULT_EIO);
+            }
+            data += single;
+        }
+        if (data != NULL) {
+            break;
+        }
+
+        if ((pending == 0) && (MDS_BOOT_UpgradeReadSubmit(src, srcOfs + readOfs, buff[idx], single) != 0)) {
+            return (MDS_BOOT_RESULT_EIO);
+        }
+
+        res = MDS_BOOT_UpgradeReadWait(src);
         if (res != 0) {
             return (MDS_BOOT_RESULT_EIO);
         }
 
-        res = MDS_BOOT_DeviceWrite(dst, srcOfs + readOfs, g_bootCheckBuff, single);
+        // read the next chunk while this one is programmed
+        pending = BOOT_CheckReadNext(src, srcOfs + readOfs + single, srcSize - readOfs - single, buff, idx);
+
+        res = MDS_BOOT_UpgradeWrite(dst, dstOfs + readOfs, buff[idx], single);
         if (res != 0) {
             return (MDS_BOOT_RESULT_EIO);
         }
@@ -278,3 +2847,33 @@ MDS_BOOT_Result_t MDS_BOOT_UpgradeCopy(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t
 
     return (MDS_BOOT_RESULT_SUCCESS);
 }
+
+MDS_BOOT_Result_t MDS_BOOT_UpgradeCopy(MDS_BOOT_Device_t *dst, MDS_BOOT_Device_t *src, uint32_t srcOfs,
+                                       uint32_t srcSize)
+{
+    uint8_t *buff[MDS_BOOT_BUFF_NUM];
+
+    int res = MDS_BOOT_UpgradeErase(dst);
+    if (res != 0) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    // a routed bin starts at its partition offset, otherwise the image sits at its package offset
+    uint32_t dstOfs = (g_bootPartitionTable != NULL) ? (0) : (BOOT_CryptOrigin(srcOfs));
+
+    // a ram destination is read into in place
+    uint8_t *window = MDS_BOOT_UpgradeWindow(dst, dstOfs, srcSize);
+    if (window != NULL) {
+        res = MDS_BOOT_UpgradeRead(src, srcOfs, window, srcSize);
+        return ((res == 0) ? (MDS_BOOT_RESULT_SUCCESS) : (MDS_BOOT_RESULT_EIO));
+    }
+
+    size_t mark = MDS_BOOT_ArenaMark();
+    MDS_BOOT_Result_t result = MDS_BOOT_RESULT_ENOMEM;
+    if (BOOT_CheckBuffAlloc(buff)) {
+        result = BOOT_UpgradeCopyStream(dst, src, srcOfs, srcSize, dstOfs, buff);
+    }
+    MDS_BOOT_ArenaRelease(mark);
+
+    return (result);
+}
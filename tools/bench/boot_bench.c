@@ -0,0 +1,370 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+/* Include ----------------------------------------------------------------- */
+#include "boot_pack.h"
+#include "boot_sim.h"
+#include "algo_common.h"
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Define ------------------------------------------------------------------ */
+#define BENCH_FLASH_SIZE     (4U << 20)
+#define BENCH_STACK_SIZE     (256U << 10)
+#define BENCH_STACK_PAINT    0xA5
+
+/* Typedef ----------------------------------------------------------------- */
+struct BENCH_Case {
+    const char *name;
+    uint16_t flag;
+    uint32_t size;
+    uint32_t comp;  // percent of the image that repeats earlier content
+};
+
+struct BENCH_Run {
+    MDS_BOOT_SimFlash_t *dst;
+    MDS_BOOT_SimFlash_t *src;
+    const MDS_BOOT_UpgradeOps_t *ops;
+    MDS_BOOT_Result_t result;
+    MDS_BOOT_SwapInfo_t swapInfo;  // kept between runs, the run after a power cut resumes from its checkpoint
+};
+
+/* Variable ---------------------------------------------------------------- */
+extern char edata, end;  // bounds of the zero initialized data, the static buffers of the library live there
+
+static const struct BENCH_Case G_BENCH_CASE[] = {
+    {"copy-16k", MDS_BOOT_FLAG_COPY, 16U << 10, 50},     {"copy-256k", MDS_BOOT_FLAG_COPY, 256U << 10, 50},
+    {"copy-1m", MDS_BOOT_FLAG_COPY, 1U << 20, 50},
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+    {"lzma-16k-0", MDS_BOOT_FLAG_LZMA, 16U << 10, 0},    {"lzma-16k-90", MDS_BOOT_FLAG_LZMA, 16U << 10, 90},
+    {"lzma-256k-0", MDS_BOOT_FLAG_LZMA, 256U << 10, 0},  {"lzma-256k-50", MDS_BOOT_FLAG_LZMA, 256U << 10, 50},
+    {"lzma-256k-90", MDS_BOOT_FLAG_LZMA, 256U << 10, 90}, {"lzma-1m-50", MDS_BOOT_FLAG_LZMA, 1U << 20, 50},
+    {"lzma-1m-90", MDS_BOOT_FLAG_LZMA, 1U << 20, 90},    {"blk-256k-50", MDS_BOOT_FLAG_LZMA_BLOCK, 256U << 10, 50},
+#endif
+#if (defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0))
+    {"lz4-256k-0", MDS_BOOT_FLAG_LZ4, 256U << 10, 0},    {"lz4-256k-50", MDS_BOOT_FLAG_LZ4, 256U << 10, 50},
+    {"lz4-256k-90", MDS_BOOT_FLAG_LZ4, 256U << 10, 90},  {"lz4-1m-90", MDS_BOOT_FLAG_LZ4, 1U << 20, 90},
+#endif
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+    {"copy-crypt-16k", MDS_BOOT_FLAG_COPY | MDS_BOOT_FLAG_CRYPT, 16U << 10, 50},
+#endif
+};
+
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+static const uint8_t G_BENCH_KEY[MDS_BOOT_CRYPT_KEY_SIZE] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+};
+#endif
+
+static const MDS_BOOT_PackLimit_t G_BENCH_LIMIT = {
+    MDS_BOOT_LZMA_DICT_SIZE,
+    MDS_BOOT_LZMA_PROBS_SIZE,
+    MDS_BOOT_LZMA_DICT_SIZE,
+    MDS_BOOT_LZ4_BLOCK_SIZE,
+};
+
+/* Function ---------------------------------------------------------------- */
+// random bytes, the given share of them copied from a recent window so the image compresses like firmware
+static void BENCH_Image(uint8_t *buff, uint32_t size, uint32_t comp, uint32_t seed)
+{
+    uint32_t x = seed | 1U;
+
+    for (uint32_t i = 0; i < size;) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        uint32_t len = 4 + (x % 28);
+        len = ((size - i) < len) ? (size - i) : (len);
+        if ((i >= 1024) && ((x % 100) < comp)) {
+            memmove(&(buff[i]), &(buff[i - 1 - ((x >> 8) % 1024)]), len);
+        } else {
+            for (uint32_t j = 0; j < len; j++) {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                buff[i + j] = (uint8_t)(x);
+            }
+        }
+        i += len;
+    }
+}
+
+// a single bin package written straight into the source flash, returns where the image lands on the destination
+static int BENCH_Package(MDS_BOOT_SimFlash_t *src, const struct BENCH_Case *bench, const uint8_t *image,
+                         const MDS_BOOT_PackLimit_t *limit, uintptr_t *dstOfs)
+{
+    MDS_BOOT_PackBin_t bin;
+
+    MDS_BOOT_Result_t result = MDS_BOOT_PackOpen(&bin, bench->flag, 0, image, bench->size, limit);
+    for (uint32_t i = 0; (result == MDS_BOOT_RESULT_SUCCESS) && (i < bin.count); i++) {
+        result = MDS_BOOT_PackUnit(&bin, i, limit);
+    }
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        result = MDS_BOOT_PackJoin(&bin, 0);
+    }
+    if ((result == MDS_BOOT_RESULT_SUCCESS) && (MDS_BOOT_PackSize(&bin, 1) > src->size)) {
+        result = MDS_BOOT_RESULT_ENOMEM;
+    }
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        uint8_t iv[MDS_BOOT_CRYPT_BLOCK] = {0};
+        MDS_BOOT_PackCrypt(&bin, G_BENCH_KEY, iv);
+    }
+#endif
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        MDS_BOOT_PackHash(&bin);
+        MDS_BOOT_PackWrite(src->mem, &bin, 1);
+    }
+    MDS_BOOT_PackClose(&bin);
+
+    // an encrypted copy lands where its crypt info starts, not behind it
+    *dstOfs = ((bench->flag & (uint16_t)(~MDS_BOOT_FLAG_CRYPT)) == MDS_BOOT_FLAG_COPY)
+                  ? (sizeof(MDS_BOOT_UpgradeInfo_t) + sizeof(MDS_BOOT_BinInfo_t))
+                  : (0);
+
+    return ((result == MDS_BOOT_RESULT_SUCCESS) ? (0) : (result));
+}
+
+#if (MDS_BOOT_WITH_TRACE > 0)
+static uint32_t BENCH_Tick(void)
+{
+    return ((uint32_t)(MDS_BOOT_SimTime() / 1000));
+}
+
+// virtual microseconds of every phase, the rest of the upgrade is library and lz4 decode
+static void BENCH_Trace(void)
+{
+    static const char *const name[MDS_BOOT_TRACE_NUM] = {"check", "hash", "read", "write", "erase", "decode", "crypt"};
+    const MDS_BOOT_TraceInfo_t *traceInfo = MDS_BOOT_GetTraceInfo();
+
+    if (traceInfo == NULL) {
+        return;
+    }
+
+    printf("  trace(us) total=%u", traceInfo->ticks);
+    for (uint16_t i = 0; i < MDS_BOOT_TRACE_NUM; i++) {
+        printf(" %s=%u/%u", name[i], traceInfo->phase[i].ticks, traceInfo->phase[i].calls);
+    }
+    printf("\n");
+}
+#endif
+
+static void *BENCH_Upgrade(void *arg)
+{
+    struct BENCH_Run *run = (struct BENCH_Run *)(arg);
+
+    run->result = MDS_BOOT_UpgradeCheck(&(run->swapInfo), &(run->dst->device), &(run->src->device), run->ops);
+
+    return (NULL);
+}
+
+// run the upgrade on a painted stack, the deepest overwritten byte is its peak usage
+static size_t BENCH_Run(struct BENCH_Run *run)
+{
+    uint8_t *stack = malloc(BENCH_STACK_SIZE);
+    pthread_attr_t attr;
+    pthread_t thread;
+    size_t used = 0;
+
+    if (stack == NULL) {
+        run->result = MDS_BOOT_RESULT_ENOMEM;
+        return (0);
+    }
+
+    memset(stack, BENCH_STACK_PAINT, BENCH_STACK_SIZE);
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, BENCH_STACK_SIZE);
+    if (pthread_create(&thread, &attr, BENCH_Upgrade, run) == 0) {
+        pthread_join(thread, NULL);
+        while ((used < BENCH_STACK_SIZE) && (stack[used] == BENCH_STACK_PAINT)) {
+            used++;
+        }
+        used = BENCH_STACK_SIZE - used;
+    } else {
+        run->result = MDS_BOOT_RESULT_ENOMEM;
+    }
+    pthread_attr_destroy(&attr);
+    free(stack);
+
+    return (used);
+}
+
+// cut the power at programs spread over the clean run, the boot after it resumes and must still land the image
+static int BENCH_Resume(struct BENCH_Run *run, const struct BENCH_Case *bench, const uint8_t *image, uintptr_t dstOfs,
+                        const uint8_t *pkg, uint32_t cuts)
+{
+    MDS_BOOT_SimFlash_t *dst = run->dst, *src = run->src;
+    uint32_t programs = dst->stat.programs;
+
+    for (uint32_t i = 1; i <= cuts; i++) {
+        uint32_t cut = (uint32_t)(((uint64_t)(programs) * i) / (cuts + 1));
+
+        memset(dst->mem, 0xFF, dst->size);
+        memcpy(src->mem, pkg, src->device.size);
+        memset(&(run->swapInfo), 0, sizeof(run->swapInfo));
+        MDS_BOOT_SimReset(dst);
+        MDS_BOOT_SimReset(src);
+        dst->cut = (cut > 0) ? (cut) : (1);
+        BENCH_Run(run);
+        dst->cut = 0;
+        BENCH_Run(run);
+
+        if ((run->result != MDS_BOOT_RESULT_SUCCESS) || (memcmp(&(dst->mem[dstOfs]), image, bench->size) != 0)) {
+            printf("  resume cut=%u/%u result=%X fail\n", cut, programs, run->result);
+            return (1);
+        }
+    }
+    printf("  resume cuts=%u ok\n", cuts);
+
+    return (0);
+}
+
+static void BENCH_Usage(const char *name)
+{
+    printf("usage: %s [options]\n"
+           "  --dst FILE        back the destination flash with FILE instead of memory\n"
+           "  --src FILE        back the source flash with FILE instead of memory\n"
+           "  --sector N        sector size in bytes (4096)\n"
+           "  --page N          program page size in bytes (256)\n"
+           "  --read-setup NS   ns per read command (1000)\n"
+           "  --read-byte NS    ns per byte read (20)\n"
+           "  --program NS      ns per program page (400000)\n"
+           "  --erase NS        ns per sector erase (45000000)\n"
+           "  --async           submit transfers and overlap them with hashing and decode\n"
+           "  --map             map the source flash like an xip flash\n"
+           "  --block N         unpack size of an lzma block (%u)\n"
+           "  --case NAME       run only the named case\n"
+           "  --resume N        after each case cut the power N times over the upgrade and check the resumed image\n"
+           "buffer sizes are build arguments, build once per mds_boot_* configuration to compare them\n",
+           name, G_BENCH_LIMIT.lzmaBlock);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option opts[] = {
+        {"dst", required_argument, NULL, 'd'},        {"src", required_argument, NULL, 's'},
+        {"sector", required_argument, NULL, 'S'},     {"page", required_argument, NULL, 'P'},
+        {"read-setup", required_argument, NULL, 'r'}, {"read-byte", required_argument, NULL, 'b'},
+        {"program", required_argument, NULL, 'p'},    {"erase", required_argument, NULL, 'e'},
+        {"async", no_argument, NULL, 'a'},            {"map", no_argument, NULL, 'm'},
+        {"block", required_argument, NULL, 'B'},      {"case", required_argument, NULL, 'c'},
+        {"resume", required_argument, NULL, 'R'},     {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    MDS_BOOT_SimTiming_t timing = {1000, 20, 400000, 45000000};
+    MDS_BOOT_PackLimit_t limit = G_BENCH_LIMIT;
+    const char *dstPath = NULL, *srcPath = NULL, *only = NULL;
+    uint32_t sectorSize = 4096, pageSize = 256, cuts = 0;
+    bool async = false, mapped = false;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", opts, NULL)) != -1) {
+        switch (opt) {
+            case 'd': dstPath = optarg; break;
+            case 's': srcPath = optarg; break;
+            case 'S': sectorSize = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'P': pageSize = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'r': timing.readSetup = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'b': timing.readByte = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'p': timing.programPage = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'e': timing.eraseSector = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'a': async = true; break;
+            case 'm': mapped = true; break;
+            case 'B': limit.lzmaBlock = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'c': only = optarg; break;
+            case 'R': cuts = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            default: BENCH_Usage(argv[0]); return ((opt == 'h') ? (0) : (1));
+        }
+    }
+
+    MDS_BOOT_SimFlash_t dst, src;
+    MDS_BOOT_UpgradeOps_t ops;
+    uint8_t *image = malloc(BENCH_FLASH_SIZE), *pkg = malloc(BENCH_FLASH_SIZE);
+    if ((image == NULL) || (pkg == NULL) ||
+        (MDS_BOOT_SimOpen(&dst, dstPath, BENCH_FLASH_SIZE, sectorSize, pageSize) != 0) ||
+        (MDS_BOOT_SimOpen(&src, srcPath, BENCH_FLASH_SIZE, sectorSize, pageSize) != 0)) {
+        printf("flash open failed\n");
+        return (1);
+    }
+    dst.timing = timing;
+    src.timing = timing;
+    src.mapped = mapped;
+    MDS_BOOT_SimOps(&ops, &dst, async);
+#if (MDS_BOOT_WITH_TRACE > 0)
+    MDS_BOOT_SetTickHook(BENCH_Tick);
+#endif
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+    static const MDS_BOOT_CryptOps_t cryptOps = {G_BENCH_KEY, NULL};
+    MDS_BOOT_SetCryptOps(&cryptOps);
+#endif
+
+    const MDS_BOOT_ArenaReport_t *report = MDS_BOOT_GetArenaReport();
+    printf("sector=%u page=%u async=%d map=%d bss=%zu\n", sectorSize, pageSize, async, mapped,
+           (size_t)(&end - &edata));
+    printf("arena=%u check=%u page=%u sector=%u lzma=%u lz4=%u delta=%u\n", report->size, report->check,
+           report->page, report->sector, report->lzma, report->lz4, report->delta);
+    printf("%-14s %8s %8s %9s %9s %9s %9s %7s %7s %6s %7s %6s %6s\n", "case", "image", "package", "time(ms)",
+           "KiB/s", "read(B)", "prog(B)", "erase", "srcErase", "dirty", "stack", "arena", "result");
+
+    int failed = 0;
+    for (size_t i = 0; i < (sizeof(G_BENCH_CASE) / sizeof(G_BENCH_CASE[0])); i++) {
+        const struct BENCH_Case *bench = &(G_BENCH_CASE[i]);
+        uintptr_t dstOfs = 0;
+
+        if ((only != NULL) && (strcmp(only, bench->name) != 0)) {
+            continue;
+        }
+
+        BENCH_Image(image, bench->size, bench->comp, (uint32_t)(i + 1));
+        memset(dst.mem, 0xFF, dst.size);
+        if (BENCH_Package(&src, bench, image, &limit, &dstOfs) != 0) {
+            printf("%-14s package failed\n", bench->name);
+            failed++;
+            continue;
+        }
+        // the package region only, the source erase after the upgrade covers its sectors and not the whole flash
+        uint32_t pkgSize = (uint32_t)(sizeof(MDS_BOOT_UpgradeInfo_t) +
+                                      ALGO_GetU32BE(((MDS_BOOT_UpgradeInfo_t *)(src.mem))->size));
+        src.device.size = ((pkgSize + sectorSize - 1) / sectorSize) * sectorSize;
+        memcpy(pkg, src.mem, src.device.size);
+        MDS_BOOT_SimReset(&dst);
+        MDS_BOOT_SimReset(&src);
+
+        struct BENCH_Run run = {&dst, &src, &ops, MDS_BOOT_RESULT_NONE, {0}};
+        uint64_t start = MDS_BOOT_SimTime();
+        size_t stack = BENCH_Run(&run);
+        uint64_t elapsed = MDS_BOOT_SimTime() - start;
+
+        bool ok = (run.result == MDS_BOOT_RESULT_SUCCESS) && (memcmp(&(dst.mem[dstOfs]), image, bench->size) == 0);
+        failed += (ok) ? (0) : (1);
+        printf("%-14s %8u %8u %9.2f %9.0f %9llu %9llu %7u %7u %6u %7zu %6u %6s\n", bench->name, bench->size, pkgSize,
+               (double)(elapsed) / 1e6, ((double)(bench->size) / 1024.0) / ((double)(elapsed) / 1e9),
+               (unsigned long long)(src.stat.readBytes + dst.stat.readBytes), (unsigned long long)(dst.stat.progBytes),
+               dst.stat.erases, src.stat.erases, dst.stat.dirty, stack, MDS_BOOT_GetUpgradeStat()->arenaPeak,
+               (ok) ? ("ok") : ("fail"));
+#if (MDS_BOOT_WITH_TRACE > 0)
+        BENCH_Trace();
+#endif
+        if ((ok) && (cuts > 0)) {
+            failed += BENCH_Resume(&run, bench, image, dstOfs, pkg, cuts);
+        }
+    }
+
+    MDS_BOOT_SimClose(&dst);
+    MDS_BOOT_SimClose(&src);
+    free(image);
+    free(pkg);
+
+    return ((failed > 0) ? (1) : (0));
+}
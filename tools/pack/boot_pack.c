@@ -0,0 +1,383 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+/* Include ----------------------------------------------------------------- */
+#include "boot_pack.h"
+#include "algo_common.h"
+#include "algo_crc.h"
+#include "algo_sha2.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+#include "LzmaEnc.h"
+#endif
+
+/* Define ------------------------------------------------------------------ */
+#define BOOT_PACK_LZMA_BASE 1984   // probs of the lzma sdk decoder besides the literal coder
+#define BOOT_PACK_LZMA_LIT  0x300  // probs of one literal coder
+#define BOOT_PACK_LZMA_HEAD (0x05 + sizeof(uint64_t))
+#define BOOT_PACK_LZ4_HASH  12     // bits of the match finder hash
+#define BOOT_PACK_LZ4_LAST  12     // a match starts this far before the end of a block at least
+#define BOOT_PACK_LZ4_RAW   0x80000000U
+#define BOOT_PACK_BLANK     0xFF
+
+/* Function ---------------------------------------------------------------- */
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+static void *BOOT_PackLzmaAlloc(ISzAllocPtr p, size_t size)
+{
+    (void)p;
+    return (malloc(size));
+}
+
+static void BOOT_PackLzmaFree(ISzAllocPtr p, void *addr)
+{
+    (void)p;
+    free(addr);
+}
+
+static const ISzAlloc G_BOOT_PACK_ALLOC = {BOOT_PackLzmaAlloc, BOOT_PackLzmaFree};
+
+// raw stream fitted to the dictionary and probs the decoder is built with, the widest literal coder that fits
+static uint32_t BOOT_PackLzma(uint8_t *out, uint32_t cap, const uint8_t *in, uint32_t size,
+                              const MDS_BOOT_PackLimit_t *limit, uint8_t props[0x05])
+{
+    CLzmaEncProps encProps;
+    SizeT propsSize = 0x05;
+    SizeT outSize = cap;
+
+    LzmaEncProps_Init(&encProps);
+    encProps.level = 9;
+    encProps.dictSize = limit->dictSize;
+    encProps.lp = 0;
+    for (encProps.lc = 3; encProps.lc > 0; encProps.lc--) {
+        if (((BOOT_PACK_LZMA_BASE + (BOOT_PACK_LZMA_LIT << encProps.lc)) * sizeof(CLzmaProb)) <= limit->probsSize) {
+            break;
+        }
+    }
+
+    if (LzmaEncode(out, &outSize, in, size, &encProps, props, &propsSize, 0, NULL, &G_BOOT_PACK_ALLOC,
+                   &G_BOOT_PACK_ALLOC) != SZ_OK) {
+        return (0);
+    }
+
+    return ((uint32_t)(outSize));
+}
+#endif
+
+#if (defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0))
+static uint8_t *BOOT_PackLz4Length(uint8_t *out, uint32_t len)
+{
+    for (; len >= UINT8_MAX; len -= UINT8_MAX) {
+        *out++ = UINT8_MAX;
+    }
+    *out++ = (uint8_t)(len);
+
+    return (out);
+}
+
+// greedy single probe lz4 block, the table lives on the stack so units encode on any thread
+static uint32_t BOOT_PackLz4(uint8_t *out, const uint8_t *in, uint32_t size)
+{
+    uint32_t table[1U << BOOT_PACK_LZ4_HASH];
+    uint8_t *op = out;
+    uint32_t anchor = 0;
+
+    memset(table, 0xFF, sizeof(table));
+    for (uint32_t ip = 0; (ip + BOOT_PACK_LZ4_LAST) < size;) {
+        uint32_t seq, cand;
+        memcpy(&seq, &(in[ip]), sizeof(seq));
+        uint32_t hash = (seq * 2654435761U) >> (32 - BOOT_PACK_LZ4_HASH);
+        uint32_t ref = table[hash];
+        table[hash] = ip;
+        if ((ref == UINT32_MAX) || ((ip - ref) > UINT16_MAX) || (memcpy(&cand, &(in[ref]), sizeof(cand)) == NULL) ||
+            (cand != seq)) {
+            ip++;
+            continue;
+        }
+
+        uint32_t len = 4;
+        while (((ip + len + 5) < size) && (in[ref + len] == in[ip + len])) {
+            len++;
+        }
+
+        uint32_t lit = ip - anchor;
+        uint8_t *token = op++;
+        *token = (uint8_t)((((lit < 15) ? (lit) : (15)) << 4) | (((len - 4) < 15) ? (len - 4) : (15)));
+        op = (lit < 15) ? (op) : (BOOT_PackLz4Length(op, lit - 15));
+        memcpy(op, &(in[anchor]), lit);
+        op += lit;
+        *op++ = (uint8_t)(ip - ref);
+        *op++ = (uint8_t)((ip - ref) >> 8);
+        op = ((len - 4) < 15) ? (op) : (BOOT_PackLz4Length(op, len - 4 - 15));
+        ip += len;
+        anchor = ip;
+    }
+
+    uint32_t lit = size - anchor;
+    *op++ = (uint8_t)(((lit < 15) ? (lit) : (15)) << 4);
+    op = (lit < 15) ? (op) : (BOOT_PackLz4Length(op, lit - 15));
+    memcpy(op, &(in[anchor]), lit);
+
+    return ((uint32_t)(op + lit - out));
+}
+#endif
+
+MDS_BOOT_Result_t MDS_BOOT_PackOpen(MDS_BOOT_PackBin_t *bin, uint16_t flag, uint32_t dstAddr, const uint8_t *image,
+                                    uint32_t size, const MDS_BOOT_PackLimit_t *limit)
+{
+    memset(bin, 0, sizeof(*bin));
+    bin->flag = flag;
+    bin->dstAddr = dstAddr;
+    bin->image = image;
+    bin->size = size;
+    bin->unitSize = size;
+    (void)(limit);
+
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+    bin->crypt = ((flag & MDS_BOOT_FLAG_CRYPT) != 0);
+    bin->flag = flag & (uint16_t)(~MDS_BOOT_FLAG_CRYPT);
+#endif
+
+    switch (bin->flag) {
+        case MDS_BOOT_FLAG_COPY: break;
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+        case MDS_BOOT_FLAG_LZMA: break;
+        case MDS_BOOT_FLAG_LZMA_BLOCK: bin->unitSize = limit->lzmaBlock; break;
+#endif
+#if (defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0))
+        case MDS_BOOT_FLAG_LZ4: bin->unitSize = limit->lz4Block; break;
+#endif
+        default: return (MDS_BOOT_RESULT_ECHECK);
+    }
+
+    if (bin->unitSize == 0) {
+        return ((size == 0) ? (MDS_BOOT_RESULT_SUCCESS) : (MDS_BOOT_RESULT_ECHECK));
+    }
+
+    bin->count = (size / bin->unitSize) + (((size % bin->unitSize) != 0) ? (1) : (0));
+    bin->count = ((bin->count == 0) && (bin->flag != MDS_BOOT_FLAG_LZMA_BLOCK)) ? (1) : (bin->count);
+    bin->unit = calloc((bin->count > 0) ? (bin->count) : (1), sizeof(MDS_BOOT_PackUnit_t));
+
+    return ((bin->unit != NULL) ? (MDS_BOOT_RESULT_SUCCESS) : (MDS_BOOT_RESULT_ENOMEM));
+}
+
+void MDS_BOOT_PackClose(MDS_BOOT_PackBin_t *bin)
+{
+    for (uint32_t i = 0; (bin->unit != NULL) && (i < bin->count); i++) {
+        free(bin->unit[i].data);
+    }
+    free(bin->unit);
+    free(bin->payload);
+    bin->unit = NULL;
+    bin->payload = NULL;
+}
+
+// units share nothing but the limit, any thread encodes any of them
+MDS_BOOT_Result_t MDS_BOOT_PackUnit(MDS_BOOT_PackBin_t *bin, uint32_t index, const MDS_BOOT_PackLimit_t *limit)
+{
+    MDS_BOOT_PackUnit_t *unit = &(bin->unit[index]);
+    uint32_t ofs = index * bin->unitSize;
+    uint32_t len = ((bin->size - ofs) > bin->unitSize) ? (bin->unitSize) : (bin->size - ofs);
+    const uint8_t *in = &(bin->image[ofs]);
+    uint32_t cap = len + (len / 2) + 1024;
+
+    (void)(limit);
+
+    unit->check = ALGO_CRC16(0, in, len);
+    unit->data = malloc(cap);
+    if (unit->data == NULL) {
+        return (MDS_BOOT_RESULT_ENOMEM);
+    }
+
+    if (bin->flag == MDS_BOOT_FLAG_COPY) {
+        memcpy(unit->data, in, len);
+        unit->size = len;
+        unit->raw = true;
+    }
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+    // props and a 64 bit unpack size ahead of a single stream, the props of a block bin sit in its block info
+    if (bin->flag == MDS_BOOT_FLAG_LZMA) {
+        unit->size = BOOT_PackLzma(&(unit->data[BOOT_PACK_LZMA_HEAD]), cap - BOOT_PACK_LZMA_HEAD, in, len, limit,
+                                   unit->props);
+        memcpy(unit->data, unit->props, sizeof(unit->props));
+        for (uint8_t i = 0; i < sizeof(uint64_t); i++) {
+            unit->data[sizeof(unit->props) + i] = (uint8_t)(((uint64_t)(len)) >> (i * __CHAR_BIT__));
+        }
+        unit->size = (unit->size > 0) ? (unit->size + BOOT_PACK_LZMA_HEAD) : (0);
+    } else if (bin->flag == MDS_BOOT_FLAG_LZMA_BLOCK) {
+        unit->size = BOOT_PackLzma(unit->data, cap, in, len, limit, unit->props);
+    }
+#endif
+#if (defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0))
+    if (bin->flag == MDS_BOOT_FLAG_LZ4) {
+        unit->size = BOOT_PackLz4(unit->data, in, len);
+        if (unit->size >= len) {
+            memcpy(unit->data, in, len);
+            unit->size = len;
+            unit->raw = true;
+        }
+    }
+#endif
+
+    return (((unit->size > 0) || (len == 0)) ? (MDS_BOOT_RESULT_SUCCESS) : (MDS_BOOT_RESULT_ENOMEM));
+}
+
+// trailing bytes of a compressed bin are hashed and never decoded, a copy bin would write them out
+bool MDS_BOOT_PackPadable(uint16_t flag)
+{
+    return ((flag == MDS_BOOT_FLAG_LZMA) || (flag == MDS_BOOT_FLAG_LZMA_BLOCK) || (flag == MDS_BOOT_FLAG_LZ4));
+}
+
+static uint32_t BOOT_PackHead(const MDS_BOOT_PackBin_t *bin)
+{
+    if (bin->flag == MDS_BOOT_FLAG_LZMA_BLOCK) {
+        return ((uint32_t)(sizeof(MDS_BOOT_BlockInfo_t) + (bin->count * sizeof(MDS_BOOT_BlockEntry_t))));
+    } else if (bin->flag == MDS_BOOT_FLAG_LZ4) {
+        return ((uint32_t)(sizeof(MDS_BOOT_Lz4Info_t) + (bin->count * sizeof(uint32_t))));
+    }
+
+    return (0);
+}
+
+// the crypt info, the block info or lz4 info, every unit behind its entry or size, then pad blank bytes
+MDS_BOOT_Result_t MDS_BOOT_PackJoin(MDS_BOOT_PackBin_t *bin, uint32_t pad)
+{
+    uint32_t base = (bin->crypt) ? ((uint32_t)(sizeof(MDS_BOOT_CryptInfo_t))) : (0);
+    uint32_t head = BOOT_PackHead(bin);
+    uint32_t size = base + head;
+
+    if ((pad > 0) && (!MDS_BOOT_PackPadable(bin->flag))) {
+        return (MDS_BOOT_RESULT_ECHECK);
+    }
+
+    for (uint32_t i = 0; i < bin->count; i++) {
+        if ((bin->flag == MDS_BOOT_FLAG_LZMA_BLOCK) &&
+            (memcmp(bin->unit[i].props, bin->unit[0].props, sizeof(bin->unit[0].props)) != 0)) {
+            return (MDS_BOOT_RESULT_ECHECK);
+        }
+        size += bin->unit[i].size;
+    }
+
+    free(bin->payload);
+    bin->payload = malloc(((size + pad) > 0) ? (size + pad) : (1));
+    if (bin->payload == NULL) {
+        return (MDS_BOOT_RESULT_ENOMEM);
+    }
+
+    uint8_t *data = &(bin->payload[base]);
+    memset(bin->payload, 0, base);
+    if (bin->flag == MDS_BOOT_FLAG_LZMA_BLOCK) {
+        MDS_BOOT_BlockInfo_t *blockInfo = (MDS_BOOT_BlockInfo_t *)(data);
+        MDS_BOOT_BlockEntry_t *entry = (MDS_BOOT_BlockEntry_t *)(&(data[sizeof(*blockInfo)]));
+        if (bin->count > 0) {
+            memcpy(blockInfo->props, bin->unit[0].props, sizeof(blockInfo->props));
+        } else {
+            memset(blockInfo->props, 0, sizeof(blockInfo->props));
+        }
+        ALGO_PutU16BE(blockInfo->count, (uint16_t)(bin->count));
+        ALGO_PutU32BE(blockInfo->blockSize, bin->unitSize);
+        ALGO_PutU32BE(blockInfo->unpackSize, bin->size);
+        for (uint32_t i = 0, ofs = 0; i < bin->count; ofs += bin->unit[i].size, i++) {
+            ALGO_PutU32BE(entry[i].ofs, ofs);
+            ALGO_PutU32BE(entry[i].size, bin->unit[i].size);
+            ALGO_PutU16BE(entry[i].check, bin->unit[i].check);
+        }
+    } else if (bin->flag == MDS_BOOT_FLAG_LZ4) {
+        MDS_BOOT_Lz4Info_t *lz4Info = (MDS_BOOT_Lz4Info_t *)(data);
+        ALGO_PutU32BE(lz4Info->blockSize, bin->unitSize);
+        ALGO_PutU32BE(lz4Info->unpackSize, bin->size);
+        head = sizeof(*lz4Info);
+    }
+
+    for (uint32_t i = 0; i < bin->count; i++) {
+        if (bin->flag == MDS_BOOT_FLAG_LZ4) {
+            ALGO_PutU32BE(&(data[head]), bin->unit[i].size | ((bin->unit[i].raw) ? (BOOT_PACK_LZ4_RAW) : (0)));
+            head += sizeof(uint32_t);
+        }
+        memcpy(&(data[head]), bin->unit[i].data, bin->unit[i].size);
+        head += bin->unit[i].size;
+    }
+    memset(&(bin->payload[size]), BOOT_PACK_BLANK, pad);
+    bin->srcSize = size + pad;
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+// encrypt the joined payload behind its crypt info, the package hashes then cover the ciphertext
+void MDS_BOOT_PackCrypt(MDS_BOOT_PackBin_t *bin, const uint8_t key[MDS_BOOT_CRYPT_KEY_SIZE],
+                        const uint8_t iv[MDS_BOOT_CRYPT_BLOCK])
+{
+    MDS_BOOT_CryptInfo_t *cryptInfo = (MDS_BOOT_CryptInfo_t *)(bin->payload);
+
+    if (!bin->crypt) {
+        return;
+    }
+
+    memcpy(cryptInfo->iv, iv, sizeof(cryptInfo->iv));
+    MDS_BOOT_CryptCtr(key, iv, &(bin->payload[sizeof(*cryptInfo)]), bin->srcSize - sizeof(*cryptInfo));
+}
+#endif
+
+void MDS_BOOT_PackHash(MDS_BOOT_PackBin_t *bin)
+{
+    MDS_BOOT_BinInfo_t *binInfo = &(bin->binInfo);
+    ALGO_SHA256_Context_t ctx;
+    ALGO_SHA256_Digest_t digest;
+
+    ALGO_SHA256_Init(&ctx);
+    ALGO_SHA256_Update(&ctx, bin->payload, bin->srcSize);
+    ALGO_SHA256_Finish(&ctx, &digest);
+
+    ALGO_PutU16BE(binInfo->flag, bin->flag | ((bin->crypt) ? (MDS_BOOT_FLAG_CRYPT) : (0)));
+    ALGO_PutU32BE(binInfo->dstAddr, bin->dstAddr);
+    ALGO_PutU32BE(binInfo->srcSize, bin->srcSize);
+    memcpy(binInfo->hash, digest.hash, sizeof(binInfo->hash));
+    ALGO_PutU16BE(binInfo->check, ALGO_CRC16(0, binInfo->flag, sizeof(*binInfo) - sizeof(binInfo->check)));
+}
+
+size_t MDS_BOOT_PackSize(const MDS_BOOT_PackBin_t *bin, uint16_t count)
+{
+    size_t size = sizeof(MDS_BOOT_UpgradeInfo_t);
+
+    for (uint16_t i = 0; i < count; i++) {
+        size += sizeof(MDS_BOOT_BinInfo_t) + bin[i].srcSize;
+    }
+
+    return (size);
+}
+
+// upgrade info then every bin behind its bin info, out holds MDS_BOOT_PackSize bytes
+void MDS_BOOT_PackWrite(uint8_t *out, const MDS_BOOT_PackBin_t *bin, uint16_t count)
+{
+    MDS_BOOT_UpgradeInfo_t *upgradeInfo = (MDS_BOOT_UpgradeInfo_t *)(out);
+    size_t size = MDS_BOOT_PackSize(bin, count) - sizeof(*upgradeInfo);
+    size_t ofs = sizeof(*upgradeInfo);
+    ALGO_SHA256_Context_t ctx;
+    ALGO_SHA256_Digest_t digest;
+
+    for (uint16_t i = 0; i < count; i++) {
+        memcpy(&(out[ofs]), &(bin[i].binInfo), sizeof(bin[i].binInfo));
+        memcpy(&(out[ofs + sizeof(bin[i].binInfo)]), bin[i].payload, bin[i].srcSize);
+        ofs += sizeof(bin[i].binInfo) + bin[i].srcSize;
+    }
+
+    ALGO_SHA256_Init(&ctx);
+    ALGO_SHA256_Update(&ctx, &(out[sizeof(*upgradeInfo)]), size);
+    ALGO_SHA256_Finish(&ctx, &digest);
+    ALGO_PutU32BE(upgradeInfo->magic, MDS_BOOT_UPGRADE_MAGIC);
+    ALGO_PutU16BE(upgradeInfo->count, count);
+    ALGO_PutU32BE(upgradeInfo->size, (uint32_t)(size));
+    memcpy(upgradeInfo->hash, digest.hash, sizeof(upgradeInfo->hash));
+    ALGO_PutU16BE(upgradeInfo->check,
+                  ALGO_CRC16(0, upgradeInfo->magic, sizeof(*upgradeInfo) - sizeof(upgradeInfo->check)));
+}
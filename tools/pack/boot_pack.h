@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+#ifndef __BOOT_PACK_H__
+#define __BOOT_PACK_H__
+
+/* Include ----------------------------------------------------------------- */
+#include "mds_boot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Typedef ----------------------------------------------------------------- */
+typedef struct MDS_BOOT_PackLimit {
+    uint32_t dictSize;   // lzma dictionary the decoder is built with
+    uint32_t probsSize;  // bytes of lzma probs the decoder is built with
+    uint32_t lzmaBlock;  // unpack size of every lzma block
+    uint32_t lz4Block;   // unpack size of every lz4 block, at most the lz4 block buffer of the decoder
+} MDS_BOOT_PackLimit_t;
+
+typedef struct MDS_BOOT_PackUnit {
+    uint8_t *data;
+    uint32_t size;        // encoded size
+    uint16_t check;       // crc16 of the unpacked unit
+    bool raw;             // stored unpacked, encoding did not shrink it
+    uint8_t props[0x05];  // lzma props the unit was encoded with
+} MDS_BOOT_PackUnit_t;
+
+// a bin cut into units encoded on their own, one per lzma or lz4 block and a single one otherwise
+typedef struct MDS_BOOT_PackBin {
+    uint16_t flag;  // codec of the bin, without MDS_BOOT_FLAG_CRYPT
+    bool crypt;     // the payload starts with a crypt info and is encrypted behind it
+    uint32_t dstAddr;
+    const uint8_t *image;
+    uint32_t size;  // unpack size
+
+    uint32_t unitSize;  // unpack size of every unit except the last one
+    uint32_t count;
+    MDS_BOOT_PackUnit_t *unit;
+
+    uint8_t *payload;  // joined units, the bin data of the package
+    uint32_t srcSize;  // payload with its padding
+    MDS_BOOT_BinInfo_t binInfo;
+} MDS_BOOT_PackBin_t;
+
+/* Function ---------------------------------------------------------------- */
+extern MDS_BOOT_Result_t MDS_BOOT_PackOpen(MDS_BOOT_PackBin_t *bin, uint16_t flag, uint32_t dstAddr,
+                                           const uint8_t *image, uint32_t size, const MDS_BOOT_PackLimit_t *limit);
+extern void MDS_BOOT_PackClose(MDS_BOOT_PackBin_t *bin);
+extern MDS_BOOT_Result_t MDS_BOOT_PackUnit(MDS_BOOT_PackBin_t *bin, uint32_t index, const MDS_BOOT_PackLimit_t *limit);
+extern MDS_BOOT_Result_t MDS_BOOT_PackJoin(MDS_BOOT_PackBin_t *bin, uint32_t pad);
+extern bool MDS_BOOT_PackPadable(uint16_t flag);
+extern void MDS_BOOT_PackCrypt(MDS_BOOT_PackBin_t *bin, const uint8_t key[MDS_BOOT_CRYPT_KEY_SIZE],
+                               const uint8_t iv[MDS_BOOT_CRYPT_BLOCK]);
+extern void MDS_BOOT_PackHash(MDS_BOOT_PackBin_t *bin);
+extern size_t MDS_BOOT_PackSize(const MDS_BOOT_PackBin_t *bin, uint16_t count);
+extern void MDS_BOOT_PackWrite(uint8_t *out, const MDS_BOOT_PackBin_t *bin, uint16_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_PACK_H__ */
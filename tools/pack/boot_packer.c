@@ -0,0 +1,502 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+/* Include ----------------------------------------------------------------- */
+#include "boot_pack.h"
+#include "boot_sim.h"
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Define ------------------------------------------------------------------ */
+#define PACKER_LINE_SIZE 1024
+#define PACKER_JOBS_MAX  64
+#define PACKER_CRYPT     "+crypt"  // codec suffix of a bin encrypted with the package key
+
+/* Typedef ----------------------------------------------------------------- */
+struct PACKER_Codec {
+    const char *name;
+    uint16_t flag;
+};
+
+struct PACKER_Pool {
+    pthread_mutex_t lock;
+    MDS_BOOT_PackBin_t *bin;
+    uint16_t count;
+    const MDS_BOOT_PackLimit_t *limit;
+    bool hash;  // hash joined bins instead of encoding units
+
+    const uint8_t *key;                  // package key of crypt bins, NULL without one
+    uint8_t (*iv)[MDS_BOOT_CRYPT_BLOCK];  // counter block of every bin, encrypted before it is hashed
+
+    uint16_t binNext;  // next job
+    uint32_t unitNext;
+    MDS_BOOT_Result_t result;
+};
+
+/* Variable ---------------------------------------------------------------- */
+static const struct PACKER_Codec G_PACKER_CODEC[] = {
+    {"copy", MDS_BOOT_FLAG_COPY},
+#if (defined(MDS_BOOT_WITH_LZMA) && (MDS_BOOT_WITH_LZMA > 0))
+    {"lzma", MDS_BOOT_FLAG_LZMA},
+    {"lzma-block", MDS_BOOT_FLAG_LZMA_BLOCK},
+#endif
+#if (defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0))
+    {"lz4", MDS_BOOT_FLAG_LZ4},
+#endif
+};
+
+/* Function ---------------------------------------------------------------- */
+static const struct PACKER_Codec *PACKER_Codec(const char *name, uint16_t flag)
+{
+    for (size_t i = 0; i < (sizeof(G_PACKER_CODEC) / sizeof(G_PACKER_CODEC[0])); i++) {
+        if (((name != NULL) && (strcmp(name, G_PACKER_CODEC[i].name) == 0)) ||
+            ((name == NULL) && (flag == G_PACKER_CODEC[i].flag))) {
+            return (&(G_PACKER_CODEC[i]));
+        }
+    }
+
+    return (NULL);
+}
+
+static uint8_t *PACKER_Load(const char *path, uint32_t *size)
+{
+    FILE *fp = fopen(path, "rb");
+    uint8_t *data = NULL;
+    long len = -1;
+
+    if ((fp != NULL) && (fseek(fp, 0, SEEK_END) == 0)) {
+        len = ftell(fp);
+    }
+    if ((len >= 0) && (len <= (long)(UINT32_MAX)) && (fseek(fp, 0, SEEK_SET) == 0)) {
+        data = malloc((len > 0) ? ((size_t)(len)) : (1));
+    }
+    if ((data != NULL) && (fread(data, 1, (size_t)(len), fp) != (size_t)(len))) {
+        free(data);
+        data = NULL;
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+
+    *size = (data != NULL) ? ((uint32_t)(len)) : (0);
+    return (data);
+}
+
+// one bin per line as `codec dstAddr path`, a path is relative to the manifest, # starts a comment
+static int PACKER_Manifest(const char *path, MDS_BOOT_PackBin_t **bin, uint16_t *count,
+                           const MDS_BOOT_PackLimit_t *limit)
+{
+    const char *slash = strrchr(path, '/');
+    int dirLen = (slash != NULL) ? ((int)(slash - path + 1)) : (0);
+    char line[PACKER_LINE_SIZE], codec[32], addr[32], file[PACKER_LINE_SIZE], full[2 * PACKER_LINE_SIZE];
+    FILE *fp = fopen(path, "r");
+    int res = 0;
+
+    if (fp == NULL) {
+        printf("%s: cannot open\n", path);
+        return (-1);
+    }
+
+    for (unsigned num = 1; (res == 0) && (fgets(line, sizeof(line), fp) != NULL); num++) {
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        int fields = sscanf(line, "%31s %31s %1023s", codec, addr, file);
+        if (fields <= 0) {
+            continue;
+        }
+
+        // a crypt bin is told apart by its codec suffix
+        size_t codecLen = strlen(codec), cryptLen = strlen(PACKER_CRYPT);
+        bool crypt = ((MDS_BOOT_WITH_CRYPT > 0) && (codecLen > cryptLen) &&
+                      (strcmp(&(codec[codecLen - cryptLen]), PACKER_CRYPT) == 0));
+        if (crypt) {
+            codec[codecLen - cryptLen] = '\0';
+        }
+
+        const struct PACKER_Codec *entry = PACKER_Codec(codec, 0);
+        char *end = NULL;
+        unsigned long dstAddr = (fields == 3) ? (strtoul(addr, &end, 0)) : (0);
+        if ((fields != 3) || (entry == NULL) || (*end != '\0') || (dstAddr > UINT32_MAX) || (*count == UINT16_MAX)) {
+            printf("%s:%u: expected `codec dstAddr path` with a codec this build decodes\n", path, num);
+            res = -1;
+            break;
+        }
+
+        snprintf(full, sizeof(full), "%.*s%s", (file[0] == '/') ? (0) : (dirLen), path, file);
+        MDS_BOOT_PackBin_t *grow = realloc(*bin, (*count + 1) * sizeof(MDS_BOOT_PackBin_t));
+        uint32_t size = 0;
+        uint8_t *image = PACKER_Load(full, &size);
+        if ((grow == NULL) || (image == NULL)) {
+            printf("%s:%u: cannot load %s\n", path, num, full);
+            free(image);
+            *bin = (grow != NULL) ? (grow) : (*bin);
+            res = -1;
+            break;
+        }
+
+        *bin = grow;
+        uint16_t flag = entry->flag | ((crypt) ? (MDS_BOOT_FLAG_CRYPT) : (0));
+        if (MDS_BOOT_PackOpen(&((*bin)[*count]), flag, (uint32_t)(dstAddr), image, size, limit) !=
+            MDS_BOOT_RESULT_SUCCESS) {
+            printf("%s:%u: cannot pack %s\n", path, num, full);
+            MDS_BOOT_PackClose(&((*bin)[*count]));
+            free(image);
+            res = -1;
+            break;
+        }
+        *count += 1;
+    }
+    fclose(fp);
+
+    return (res);
+}
+
+// bins start on a destination sector and never overlap, a later bin erasing its sectors leaves earlier ones alone
+static int PACKER_Layout(const MDS_BOOT_PackBin_t *bin, uint16_t count, uint32_t sectorSize)
+{
+    uint64_t end = 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+        if ((bin[i].dstAddr % sectorSize) != 0) {
+            printf("bin %u: dstAddr 0x%08X is not on a %u byte sector\n", i, bin[i].dstAddr, sectorSize);
+            return (-1);
+        }
+        if (bin[i].dstAddr < end) {
+            printf("bin %u: dstAddr 0x%08X overlaps the bin before it\n", i, bin[i].dstAddr);
+            return (-1);
+        }
+        end = (uint64_t)(bin[i].dstAddr) + bin[i].size;
+    }
+
+    return (0);
+}
+
+static void *PACKER_Worker(void *arg)
+{
+    struct PACKER_Pool *pool = (struct PACKER_Pool *)(arg);
+
+    for (;;) {
+        MDS_BOOT_PackBin_t *bin = NULL;
+        uint32_t unit = 0;
+
+        pthread_mutex_lock(&(pool->lock));
+        while ((pool->binNext < pool->count) && (!pool->hash) && (pool->unitNext >= pool->bin[pool->binNext].count)) {
+            pool->binNext += 1;
+            pool->unitNext = 0;
+        }
+        if ((pool->binNext < pool->count) && (pool->result == MDS_BOOT_RESULT_SUCCESS)) {
+            bin = &(pool->bin[pool->binNext]);
+            unit = pool->unitNext++;
+            pool->binNext += (pool->hash) ? (1) : (0);
+        }
+        pthread_mutex_unlock(&(pool->lock));
+
+        if (bin == NULL) {
+            break;
+        }
+
+        MDS_BOOT_Result_t result = MDS_BOOT_RESULT_SUCCESS;
+        if (pool->hash) {
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+            MDS_BOOT_PackCrypt(bin, pool->key, pool->iv[bin - pool->bin]);
+#endif
+            MDS_BOOT_PackHash(bin);
+        } else {
+            result = MDS_BOOT_PackUnit(bin, unit, pool->limit);
+        }
+        if (result != MDS_BOOT_RESULT_SUCCESS) {
+            pthread_mutex_lock(&(pool->lock));
+            pool->result = result;
+            pthread_mutex_unlock(&(pool->lock));
+        }
+    }
+
+    return (NULL);
+}
+
+static MDS_BOOT_Result_t PACKER_Run(struct PACKER_Pool *pool, bool hash, unsigned jobs)
+{
+    pthread_t thread[PACKER_JOBS_MAX];
+    unsigned started = 0;
+
+    pool->hash = hash;
+    pool->binNext = 0;
+    pool->unitNext = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&(thread[started]), NULL, PACKER_Worker, pool) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        PACKER_Worker(pool);
+    }
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(thread[i], NULL);
+    }
+
+    return (pool->result);
+}
+
+// a fresh counter block for every bin, the key is never used twice with one
+static int PACKER_Iv(struct PACKER_Pool *pool)
+{
+    FILE *fp = fopen("/dev/urandom", "rb");
+    bool crypt = false;
+    int res = 0;
+
+    pool->iv = calloc((pool->count > 0) ? (pool->count) : (1), sizeof(*(pool->iv)));
+    for (uint16_t i = 0; (pool->iv != NULL) && (i < pool->count); i++) {
+        crypt = (crypt) || (pool->bin[i].crypt);
+    }
+    if ((pool->iv == NULL) || ((crypt) && (pool->key == NULL))) {
+        printf("%s\n", (pool->iv == NULL) ? ("out of memory") : ("crypt bins need --key"));
+        res = -1;
+    } else if ((crypt) &&
+               ((fp == NULL) || (fread(pool->iv, sizeof(*(pool->iv)), pool->count, fp) != pool->count))) {
+        printf("/dev/urandom: read failed\n");
+        res = -1;
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+
+    return (res);
+}
+
+static int PACKER_Key(const char *hex, uint8_t key[MDS_BOOT_CRYPT_KEY_SIZE])
+{
+    if (strlen(hex) != (2 * MDS_BOOT_CRYPT_KEY_SIZE)) {
+        return (-1);
+    }
+
+    for (size_t i = 0; i < MDS_BOOT_CRYPT_KEY_SIZE; i++) {
+        char byte[3] = {hex[2 * i], hex[(2 * i) + 1], '\0'};
+        char *end = NULL;
+        key[i] = (uint8_t)(strtoul(byte, &end, 16));
+        if (*end != '\0') {
+            return (-1);
+        }
+    }
+
+    return (0);
+}
+
+// pad a compressed bin so the payload of the next one starts on a page of the source flash
+static MDS_BOOT_Result_t PACKER_Join(MDS_BOOT_PackBin_t *bin, uint16_t count, uint32_t pageSize)
+{
+    size_t ofs = sizeof(MDS_BOOT_UpgradeInfo_t);
+
+    for (uint16_t i = 0; i < count; i++) {
+        MDS_BOOT_Result_t result = MDS_BOOT_PackJoin(&(bin[i]), 0);
+        size_t next = ofs + sizeof(MDS_BOOT_BinInfo_t) + bin[i].srcSize + sizeof(MDS_BOOT_BinInfo_t);
+        if ((result == MDS_BOOT_RESULT_SUCCESS) && (pageSize > 1) && ((i + 1) < count) &&
+            (MDS_BOOT_PackPadable(bin[i].flag)) && ((next % pageSize) != 0)) {
+            result = MDS_BOOT_PackJoin(&(bin[i]), (uint32_t)(pageSize - (next % pageSize)));
+        }
+        if (result != MDS_BOOT_RESULT_SUCCESS) {
+            return (result);
+        }
+        ofs += sizeof(MDS_BOOT_BinInfo_t) + bin[i].srcSize;
+    }
+
+    return (MDS_BOOT_RESULT_SUCCESS);
+}
+
+// install the package with the library on simulated flash, one partition spans every bin at its dstAddr
+static int PACKER_Check(const uint8_t *pkg, size_t size, const MDS_BOOT_PackBin_t *bin, uint16_t count,
+                        uint32_t sectorSize, uint32_t pageSize, const uint8_t *key)
+{
+    MDS_BOOT_SimFlash_t dst, src;
+    MDS_BOOT_UpgradeOps_t ops;
+    MDS_BOOT_CryptOps_t cryptOps = {key, NULL};
+    MDS_BOOT_SwapInfo_t swapInfo = {0};
+    uint32_t base = (count > 0) ? (bin[0].dstAddr) : (0);
+    uint64_t end = base + sectorSize;
+
+    for (uint16_t i = 0; i < count; i++) {
+        end = (((uint64_t)(bin[i].dstAddr) + bin[i].size) > end) ? ((uint64_t)(bin[i].dstAddr) + bin[i].size) : (end);
+    }
+    end = ((end + sectorSize - 1) / sectorSize) * sectorSize;
+
+    if ((MDS_BOOT_SimOpen(&src, NULL, ((size + sectorSize - 1) / sectorSize) * sectorSize, sectorSize, pageSize) !=
+         0) ||
+        (MDS_BOOT_SimOpen(&dst, NULL, (size_t)(end - base), sectorSize, pageSize) != 0)) {
+        printf("check: flash open failed\n");
+        return (-1);
+    }
+
+    memcpy(src.mem, pkg, size);
+    memset(dst.mem, 0xFF, dst.size);
+    MDS_BOOT_Partition_t part = {base, (uint32_t)(end - base), &(dst.device)};
+    MDS_BOOT_SetPartitionTable(&part, 1);
+    MDS_BOOT_SetCryptOps((key != NULL) ? (&cryptOps) : (NULL));
+    MDS_BOOT_SimOps(&ops, &dst, false);
+    MDS_BOOT_Result_t result = MDS_BOOT_UpgradeCheck(&swapInfo, &(dst.device), &(src.device), &ops);
+    MDS_BOOT_SetCryptOps(NULL);
+    MDS_BOOT_SetPartitionTable(NULL, 0);
+
+    int failed = (result == MDS_BOOT_RESULT_SUCCESS) ? (0) : (1);
+    for (uint16_t i = 0; (failed == 0) && (i < count); i++) {
+        if (memcmp(&(dst.mem[bin[i].dstAddr - base]), bin[i].image, bin[i].size) != 0) {
+            printf("check: bin %u differs on the destination\n", i);
+            failed++;
+        }
+    }
+    printf("check: result=%04X arena=%u/%u %s\n", result, MDS_BOOT_GetUpgradeStat()->arenaPeak,
+           MDS_BOOT_GetUpgradeStat()->arenaSize, (failed == 0) ? ("ok") : ("fail"));
+
+    MDS_BOOT_SimClose(&dst);
+    MDS_BOOT_SimClose(&src);
+
+    return ((failed == 0) ? (0) : (-1));
+}
+
+static void PACKER_Usage(const char *name)
+{
+    printf("usage: %s [options] MANIFEST\n"
+           "  --out FILE        write the package to FILE\n"
+           "  --jobs N          threads encoding and hashing bins (online cpus)\n"
+           "  --page N          source flash page the bin payloads are aligned to, 0 packs them tight (256)\n"
+           "  --sector N        destination sector every dstAddr sits on (4096)\n"
+           "  --dict N          lzma dictionary of the decoder (%u)\n"
+           "  --probs N         lzma probs bytes of the decoder (%u)\n"
+           "  --block N         unpack size of an lzma block (%u)\n"
+           "  --key HEX         aes-128 key of the bins whose codec ends in " PACKER_CRYPT "\n"
+           "  --check           install the package with this build of the library and compare every bin\n"
+           "MANIFEST lists one bin per line as `codec dstAddr path`, codecs of this build:",
+           name, MDS_BOOT_LZMA_DICT_SIZE, MDS_BOOT_LZMA_PROBS_SIZE, MDS_BOOT_LZMA_DICT_SIZE);
+    for (size_t i = 0; i < (sizeof(G_PACKER_CODEC) / sizeof(G_PACKER_CODEC[0])); i++) {
+        printf(" %s", G_PACKER_CODEC[i].name);
+    }
+    printf("%s\n", (MDS_BOOT_WITH_CRYPT > 0) ? (", each of them with " PACKER_CRYPT) : (""));
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option opts[] = {
+        {"out", required_argument, NULL, 'o'},   {"jobs", required_argument, NULL, 'j'},
+        {"page", required_argument, NULL, 'P'},  {"sector", required_argument, NULL, 'S'},
+        {"dict", required_argument, NULL, 'd'},  {"probs", required_argument, NULL, 'p'},
+        {"block", required_argument, NULL, 'b'}, {"check", no_argument, NULL, 'c'},
+        {"key", required_argument, NULL, 'k'},   {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    MDS_BOOT_PackLimit_t limit = {
+        MDS_BOOT_LZMA_DICT_SIZE,
+        MDS_BOOT_LZMA_PROBS_SIZE,
+        MDS_BOOT_LZMA_DICT_SIZE,
+        MDS_BOOT_LZ4_BLOCK_SIZE,
+    };
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned jobs = (online > 0) ? ((unsigned)(online)) : (1);
+    uint32_t pageSize = 256, sectorSize = 4096;
+    const char *outPath = NULL;
+    uint8_t key[MDS_BOOT_CRYPT_KEY_SIZE];
+    bool check = false, keyed = false;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", opts, NULL)) != -1) {
+        switch (opt) {
+            case 'o': outPath = optarg; break;
+            case 'j': jobs = (unsigned)(strtoul(optarg, NULL, 0)); break;
+            case 'P': pageSize = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'S': sectorSize = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'd': limit.dictSize = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'p': limit.probsSize = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'b': limit.lzmaBlock = (uint32_t)(strtoul(optarg, NULL, 0)); break;
+            case 'c': check = true; break;
+            case 'k':
+                if (PACKER_Key(optarg, key) != 0) {
+                    printf("--key takes %u hex digits\n", 2 * MDS_BOOT_CRYPT_KEY_SIZE);
+                    return (1);
+                }
+                keyed = true;
+                break;
+            default: PACKER_Usage(argv[0]); return ((opt == 'h') ? (0) : (1));
+        }
+    }
+    if ((optind != (argc - 1)) || (outPath == NULL) || (sectorSize == 0)) {
+        PACKER_Usage(argv[0]);
+        return (1);
+    }
+    jobs = (jobs == 0) ? (1) : ((jobs > PACKER_JOBS_MAX) ? (PACKER_JOBS_MAX) : (jobs));
+
+    struct PACKER_Pool pool = {.limit = &limit, .key = (keyed) ? (key) : (NULL), .result = MDS_BOOT_RESULT_SUCCESS};
+    uint8_t *pkg = NULL;
+    size_t size = 0;
+    int res = PACKER_Manifest(argv[optind], &(pool.bin), &(pool.count), &limit);
+    if (res == 0) {
+        res = PACKER_Layout(pool.bin, pool.count, sectorSize);
+    }
+    if (res == 0) {
+        res = PACKER_Iv(&pool);
+    }
+
+    pthread_mutex_init(&(pool.lock), NULL);
+    if ((res == 0) && ((PACKER_Run(&pool, false, jobs) != MDS_BOOT_RESULT_SUCCESS) ||
+                       (PACKER_Join(pool.bin, pool.count, pageSize) != MDS_BOOT_RESULT_SUCCESS) ||
+                       (PACKER_Run(&pool, true, jobs) != MDS_BOOT_RESULT_SUCCESS))) {
+        printf("encode failed: %04X\n", pool.result);
+        res = -1;
+    }
+    pthread_mutex_destroy(&(pool.lock));
+
+    if (res == 0) {
+        size = MDS_BOOT_PackSize(pool.bin, pool.count);
+        pkg = malloc(size);
+        res = (pkg != NULL) ? (0) : (-1);
+    }
+    if (res == 0) {
+        MDS_BOOT_PackWrite(pkg, pool.bin, pool.count);
+        FILE *fp = fopen(outPath, "wb");
+        if ((fp == NULL) || (fwrite(pkg, 1, size, fp) != size)) {
+            printf("%s: write failed\n", outPath);
+            res = -1;
+        }
+        if ((fp != NULL) && (fclose(fp) != 0)) {
+            res = -1;
+        }
+    }
+
+    if (res == 0) {
+        printf("%-4s %-16s %10s %10s %10s %6s\n", "bin", "codec", "dstAddr", "image", "payload", "ratio");
+        for (uint16_t i = 0; i < pool.count; i++) {
+            const MDS_BOOT_PackBin_t *bin = &(pool.bin[i]);
+            char codec[32];
+            snprintf(codec, sizeof(codec), "%s%s", PACKER_Codec(NULL, bin->flag)->name,
+                     (bin->crypt) ? (PACKER_CRYPT) : (""));
+            printf("%-4u %-16s 0x%08X %10u %10u %5.1f%%\n", i, codec, bin->dstAddr, bin->size, bin->srcSize,
+                   (bin->size > 0) ? ((100.0 * bin->srcSize) / bin->size) : (0.0));
+        }
+        printf("package %s: %zu bytes, %u bins, %u jobs\n", outPath, size, pool.count, jobs);
+    }
+    if ((res == 0) && (check)) {
+        res = PACKER_Check(pkg, size, pool.bin, pool.count, sectorSize, (pageSize > 0) ? (pageSize) : (256),
+                           pool.key);
+    }
+
+    for (uint16_t i = 0; i < pool.count; i++) {
+        free((void *)(pool.bin[i].image));
+        MDS_BOOT_PackClose(&(pool.bin[i]));
+    }
+    free(pool.bin);
+    free(pool.iv);
+    free(pkg);
+
+    return ((res == 0) ? (0) : (1));
+}
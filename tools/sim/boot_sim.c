@@ -0,0 +1,285 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+/* Include ----------------------------------------------------------------- */
+#include "boot_sim.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Define ------------------------------------------------------------------ */
+#define BOOT_SIM_BLANK 0xFF
+
+/* Variable ---------------------------------------------------------------- */
+static uint64_t g_simStall = 0;
+
+/* Function ---------------------------------------------------------------- */
+// virtual time is host time plus every stall on a device, so cpu work overlapped with a transfer is free
+uint64_t MDS_BOOT_SimTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (((uint64_t)(ts.tv_sec) * 1000000000U) + (uint64_t)(ts.tv_nsec) + g_simStall);
+}
+
+static void BOOT_SimStart(MDS_BOOT_SimFlash_t *flash, uint64_t cost)
+{
+    uint64_t now = MDS_BOOT_SimTime();
+    uint64_t start = (flash->ready > now) ? (flash->ready) : (now);
+
+    flash->ready = start + cost;
+    flash->stat.busy += cost;
+}
+
+static void BOOT_SimBlock(MDS_BOOT_SimFlash_t *flash)
+{
+    uint64_t now = MDS_BOOT_SimTime();
+
+    if (flash->ready > now) {
+        g_simStall += flash->ready - now;
+        flash->stat.stall += flash->ready - now;
+    }
+}
+
+static bool BOOT_SimRange(const MDS_BOOT_SimFlash_t *flash, uintptr_t ofs, size_t len)
+{
+    return ((ofs <= flash->size) && (len <= (flash->size - ofs)));
+}
+
+static int BOOT_SimRead(MDS_BOOT_SimFlash_t *flash, uintptr_t ofs, uint8_t *data, size_t len)
+{
+    if (!BOOT_SimRange(flash, ofs, len)) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    memcpy(data, &(flash->mem[ofs]), len);
+    flash->stat.reads += 1;
+    flash->stat.readBytes += len;
+    BOOT_SimStart(flash, flash->timing.readSetup + ((uint64_t)(flash->timing.readByte) * len));
+
+    return (0);
+}
+
+static bool BOOT_SimPowered(const MDS_BOOT_SimFlash_t *flash)
+{
+    return ((flash->cut == 0) || (flash->stat.programs < flash->cut));
+}
+
+// nor program only clears bits, a cell that was not blank keeps the and of both values
+static int BOOT_SimProgram(MDS_BOOT_SimFlash_t *flash, uintptr_t ofs, const uint8_t *data, size_t len)
+{
+    if ((!BOOT_SimRange(flash, ofs, len)) || (!BOOT_SimPowered(flash))) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        if ((flash->mem[ofs + i] & data[i]) != data[i]) {
+            flash->stat.dirty += 1;
+        }
+        flash->mem[ofs + i] &= data[i];
+    }
+
+    uint32_t pages = (len == 0) ? (0) : ((uint32_t)(((ofs + len - 1) / flash->pageSize) - (ofs / flash->pageSize)) + 1);
+    flash->stat.programs += 1;
+    flash->stat.progBytes += len;
+    flash->stat.pages += pages;
+    BOOT_SimStart(flash, (uint64_t)(flash->timing.programPage) * pages);
+
+    return (0);
+}
+
+static int BOOT_SimReadOps(MDS_BOOT_Device_t *dev, uintptr_t ofs, uint8_t *data, size_t len)
+{
+    MDS_BOOT_SimFlash_t *flash = (MDS_BOOT_SimFlash_t *)(dev->arg);
+
+    int res = BOOT_SimRead(flash, ofs, data, len);
+    BOOT_SimBlock(flash);
+
+    return (res);
+}
+
+static int BOOT_SimWriteOps(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *data, size_t len)
+{
+    MDS_BOOT_SimFlash_t *flash = (MDS_BOOT_SimFlash_t *)(dev->arg);
+
+    int res = BOOT_SimProgram(flash, ofs, data, len);
+    BOOT_SimBlock(flash);
+
+    return (res);
+}
+
+// a sector erase clears every sector the range touches
+static int BOOT_SimEraseSectorOps(MDS_BOOT_Device_t *dev, uintptr_t ofs, size_t len)
+{
+    MDS_BOOT_SimFlash_t *flash = (MDS_BOOT_SimFlash_t *)(dev->arg);
+
+    if ((!BOOT_SimRange(flash, ofs, len)) || (!BOOT_SimPowered(flash))) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    uintptr_t lo = ofs - (ofs % flash->sectorSize);
+    uintptr_t hi = ((ofs + len + flash->sectorSize - 1) / flash->sectorSize) * flash->sectorSize;
+    hi = (hi > flash->size) ? (flash->size) : (hi);
+
+    memset(&(flash->mem[lo]), BOOT_SIM_BLANK, hi - lo);
+    flash->stat.erases += (uint32_t)((hi - lo) / flash->sectorSize);
+    BOOT_SimStart(flash, (uint64_t)(flash->timing.eraseSector) * ((hi - lo) / flash->sectorSize));
+    BOOT_SimBlock(flash);
+
+    return (0);
+}
+
+static int BOOT_SimEraseOps(MDS_BOOT_Device_t *dev)
+{
+    MDS_BOOT_SimFlash_t *flash = (MDS_BOOT_SimFlash_t *)(dev->arg);
+
+    int res = BOOT_SimEraseSectorOps(dev, 0, flash->size);
+    flash->stat.chips += 1;
+
+    return (res);
+}
+
+static int BOOT_SimReadSubmitOps(MDS_BOOT_Device_t *dev, uintptr_t ofs, uint8_t *data, size_t len)
+{
+    MDS_BOOT_SimFlash_t *flash = (MDS_BOOT_SimFlash_t *)(dev->arg);
+
+    if (flash->pending) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    int res = BOOT_SimRead(flash, ofs, data, len);
+    flash->pending = (res == 0);
+
+    return (res);
+}
+
+static int BOOT_SimWriteSubmitOps(MDS_BOOT_Device_t *dev, uintptr_t ofs, const uint8_t *data, size_t len)
+{
+    MDS_BOOT_SimFlash_t *flash = (MDS_BOOT_SimFlash_t *)(dev->arg);
+
+    if (flash->pending) {
+        return (MDS_BOOT_RESULT_EIO);
+    }
+
+    int res = BOOT_SimProgram(flash, ofs, data, len);
+    flash->pending = (res == 0);
+
+    return (res);
+}
+
+static int BOOT_SimWaitOps(MDS_BOOT_Device_t *dev)
+{
+    MDS_BOOT_SimFlash_t *flash = (MDS_BOOT_SimFlash_t *)(dev->arg);
+
+    BOOT_SimBlock(flash);
+    flash->pending = false;
+
+    return (0);
+}
+
+static void *BOOT_SimMapOps(MDS_BOOT_Device_t *dev, uintptr_t ofs, size_t len, bool write)
+{
+    MDS_BOOT_SimFlash_t *flash = (MDS_BOOT_SimFlash_t *)(dev->arg);
+
+    if ((!flash->mapped) || (write) || (!BOOT_SimRange(flash, ofs, len))) {
+        return (NULL);
+    }
+
+    flash->stat.readBytes += len;
+
+    return (&(flash->mem[ofs]));
+}
+
+// back the flash with a file, or anonymous memory without a path, cells beyond the old file end read as erased
+int MDS_BOOT_SimOpen(MDS_BOOT_SimFlash_t *flash, const char *path, size_t size, uint32_t sectorSize,
+                     uint32_t pageSize)
+{
+    struct stat st = {0};
+    void *mem;
+
+    memset(flash, 0, sizeof(*flash));
+    flash->fd = -1;
+    if ((size == 0) || (sectorSize == 0) || (pageSize == 0) || ((size % sectorSize) != 0)) {
+        return (MDS_BOOT_RESULT_ECHECK);
+    }
+
+    if (path != NULL) {
+        flash->fd = open(path, O_RDWR | O_CREAT, 0644);
+        if ((flash->fd < 0) || (fstat(flash->fd, &st) != 0) || (ftruncate(flash->fd, (off_t)(size)) != 0)) {
+            MDS_BOOT_SimClose(flash);
+            return (MDS_BOOT_RESULT_EIO);
+        }
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, flash->fd, 0);
+    } else {
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+
+    if (mem == MAP_FAILED) {
+        MDS_BOOT_SimClose(flash);
+        return (MDS_BOOT_RESULT_ENOMEM);
+    }
+
+    flash->mem = (uint8_t *)(mem);
+    flash->size = size;
+    flash->sectorSize = sectorSize;
+    flash->pageSize = pageSize;
+    flash->device.arg = flash;
+    if ((size_t)(st.st_size) < size) {
+        memset(&(flash->mem[st.st_size]), BOOT_SIM_BLANK, size - (size_t)(st.st_size));
+    }
+
+    return (0);
+}
+
+void MDS_BOOT_SimClose(MDS_BOOT_SimFlash_t *flash)
+{
+    if (flash->mem != NULL) {
+        munmap(flash->mem, flash->size);
+        flash->mem = NULL;
+    }
+
+    if (flash->fd >= 0) {
+        close(flash->fd);
+        flash->fd = -1;
+    }
+}
+
+void MDS_BOOT_SimReset(MDS_BOOT_SimFlash_t *flash)
+{
+    memset(&(flash->stat), 0, sizeof(flash->stat));
+    flash->ready = 0;
+    flash->pending = false;
+}
+
+// ops of the flash the upgrade writes, its geometry is reported for lazy erase and page programming
+void MDS_BOOT_SimOps(MDS_BOOT_UpgradeOps_t *ops, const MDS_BOOT_SimFlash_t *flash, bool async)
+{
+    memset(ops, 0, sizeof(*ops));
+
+    ops->read = BOOT_SimReadOps;
+    ops->write = BOOT_SimWriteOps;
+    ops->erase = BOOT_SimEraseOps;
+    ops->eraseSector = BOOT_SimEraseSectorOps;
+    ops->map = BOOT_SimMapOps;
+    ops->sectorSize = flash->sectorSize;
+    ops->pageSize = flash->pageSize;
+
+    if (async) {
+        ops->readSubmit = BOOT_SimReadSubmitOps;
+        ops->writeSubmit = BOOT_SimWriteSubmitOps;
+        ops->wait = BOOT_SimWaitOps;
+    }
+}
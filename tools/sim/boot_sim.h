@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+#ifndef __BOOT_SIM_H__
+#define __BOOT_SIM_H__
+
+/* Include ----------------------------------------------------------------- */
+#include "mds_boot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Typedef ----------------------------------------------------------------- */
+typedef struct MDS_BOOT_SimTiming {
+    uint32_t readSetup;    // ns, command and address phase of every read
+    uint32_t readByte;     // ns per byte read
+    uint32_t programPage;  // ns per program page, a partial page costs a whole one
+    uint32_t eraseSector;  // ns per erased sector
+} MDS_BOOT_SimTiming_t;
+
+typedef struct MDS_BOOT_SimStat {
+    uint32_t reads;      // read transfers
+    uint64_t readBytes;  // bytes read, mapped access included
+    uint32_t programs;   // program transfers
+    uint64_t progBytes;  // bytes programmed
+    uint32_t pages;      // program pages touched
+    uint32_t erases;     // sectors erased
+    uint32_t chips;      // whole device erases
+    uint32_t dirty;      // bytes programmed over a non blank cell
+    uint64_t busy;       // ns the device was busy
+    uint64_t stall;      // ns the caller was blocked on the device
+} MDS_BOOT_SimStat_t;
+
+typedef struct MDS_BOOT_SimFlash {
+    MDS_BOOT_Device_t device;  // handed to the upgrade, its arg points back to the flash
+
+    int fd;
+    uint8_t *mem;
+    size_t size;
+    bool mapped;  // memory mapped like an xip flash, reads may bypass the ops
+
+    uint32_t sectorSize;
+    uint32_t pageSize;
+    MDS_BOOT_SimTiming_t timing;
+    MDS_BOOT_SimStat_t stat;
+
+    uint64_t ready;  // virtual time the device finishes the transfer in flight
+    bool pending;
+    uint32_t cut;  // program transfers before the power is lost, every later program and erase fails, 0 never
+} MDS_BOOT_SimFlash_t;
+
+/* Function ---------------------------------------------------------------- */
+extern int MDS_BOOT_SimOpen(MDS_BOOT_SimFlash_t *flash, const char *path, size_t size, uint32_t sectorSize,
+                            uint32_t pageSize);
+extern void MDS_BOOT_SimClose(MDS_BOOT_SimFlash_t *flash);
+extern void MDS_BOOT_SimReset(MDS_BOOT_SimFlash_t *flash);
+extern uint64_t MDS_BOOT_SimTime(void);
+extern void MDS_BOOT_SimOps(MDS_BOOT_UpgradeOps_t *ops, const MDS_BOOT_SimFlash_t *flash, bool async);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_SIM_H__ */
@@ -0,0 +1,33 @@
+#!/usr/bin/env python3
+# Copyright (c) [2022] [pchom]
+# [MDS] is licensed under Mulan PSL v2.
+# You can use this software according to the terms and conditions of the Mulan PSL v2.
+# You may obtain a copy of Mulan PSL v2 at:
+#          http://license.coscl.org.cn/MulanPSL2
+# THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+# EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+# MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+# See the Mulan PSL v2 for more details.
+"""run a host tool of the build, usage: boot_run.py STAMP TOOL [ARGS...]
+
+the stamp is touched only when the tool exits with 0, so the action fails and runs again until it passes
+"""
+import subprocess
+import sys
+
+
+def main(argv):
+    if len(argv) < 3:
+        print(__doc__)
+        return 1
+
+    res = subprocess.call(argv[2:])
+    if res == 0:
+        with open(argv[1], "w"):
+            pass
+
+    return res
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
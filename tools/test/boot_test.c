@@ -0,0 +1,315 @@
+/**
+ * Copyright (c) [2022] [pchom]
+ * [MDS] is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ **/
+/* Include ----------------------------------------------------------------- */
+#include "boot_pack.h"
+#include "boot_sim.h"
+#include "algo_common.h"
+#include "algo_sha2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Define ------------------------------------------------------------------ */
+#define TEST_FLASH_SIZE  (256U << 10)
+#define TEST_SECTOR_SIZE 4096
+#define TEST_PAGE_SIZE   256
+
+#define TEST_DELTA_CTRL_SIZE (sizeof(uint32_t) + sizeof(uint32_t) + sizeof(int32_t))
+#define TEST_DELTA_INSERT    3000
+
+/* Typedef ----------------------------------------------------------------- */
+struct TEST_Flash {
+    MDS_BOOT_SimFlash_t dst;
+    MDS_BOOT_SimFlash_t src;
+    MDS_BOOT_SimFlash_t stage;
+    MDS_BOOT_UpgradeOps_t ops;
+};
+
+struct TEST_Case {
+    const char *name;
+    int (*run)(struct TEST_Flash *flash);
+};
+
+/* Variable ---------------------------------------------------------------- */
+#if ((defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0)) || \
+     (defined(MDS_BOOT_WITH_DELTA) && (MDS_BOOT_WITH_DELTA > 0)))
+static const MDS_BOOT_PackLimit_t G_TEST_LIMIT = {
+    MDS_BOOT_LZMA_DICT_SIZE,
+    MDS_BOOT_LZMA_PROBS_SIZE,
+    MDS_BOOT_LZMA_DICT_SIZE,
+    MDS_BOOT_LZ4_BLOCK_SIZE,
+};
+#endif
+
+/* Function ---------------------------------------------------------------- */
+// packages are only installed by the codec cases
+#if ((defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0)) || \
+     (defined(MDS_BOOT_WITH_DELTA) && (MDS_BOOT_WITH_DELTA > 0)))
+// random bytes with runs copied from behind, so every codec finds matches and raw stretches alike
+static void TEST_Image(uint8_t *buff, uint32_t size, uint32_t seed)
+{
+    uint32_t x = seed | 1U;
+
+    for (uint32_t i = 0; i < size; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buff[i] = ((i >= 64) && ((x % 4) != 0)) ? (buff[i - 1 - ((x >> 8) % 64)]) : ((uint8_t)(x >> 16));
+    }
+}
+
+// a single bin package in the source flash, flag overrides the codec of the packed bin when it is not NONE
+static MDS_BOOT_Result_t TEST_Package(struct TEST_Flash *flash, uint16_t packFlag, uint16_t flag,
+                                      const uint8_t *data, uint32_t size)
+{
+    MDS_BOOT_PackBin_t bin;
+
+    MDS_BOOT_Result_t result = MDS_BOOT_PackOpen(&bin, packFlag, 0, data, size, &G_TEST_LIMIT);
+    for (uint32_t i = 0; (result == MDS_BOOT_RESULT_SUCCESS) && (i < bin.count); i++) {
+        result = MDS_BOOT_PackUnit(&bin, i, &G_TEST_LIMIT);
+    }
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        result = MDS_BOOT_PackJoin(&bin, 0);
+    }
+    if ((result == MDS_BOOT_RESULT_SUCCESS) && (MDS_BOOT_PackSize(&bin, 1) > flash->src.size)) {
+        result = MDS_BOOT_RESULT_ENOMEM;
+    }
+    if (result == MDS_BOOT_RESULT_SUCCESS) {
+        bin.flag = (flag != MDS_BOOT_FLAG_NONE) ? (flag) : (bin.flag);
+        MDS_BOOT_PackHash(&bin);
+        memset(flash->src.mem, 0xFF, flash->src.size);
+        MDS_BOOT_PackWrite(flash->src.mem, &bin, 1);
+    }
+    MDS_BOOT_PackClose(&bin);
+
+    return (result);
+}
+
+static MDS_BOOT_Result_t TEST_Install(struct TEST_Flash *flash)
+{
+    MDS_BOOT_SwapInfo_t swapInfo = {0};
+
+    MDS_BOOT_SimReset(&(flash->dst));
+    MDS_BOOT_SimReset(&(flash->src));
+
+    return (MDS_BOOT_UpgradeCheck(&swapInfo, &(flash->dst.device), &(flash->src.device), &(flash->ops)));
+}
+#endif
+
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+// fips-197 c.1 through the keystream of a zero payload, then two blocks of sp 800-38a f.5.1 across a counter carry
+static int TEST_CryptKat(struct TEST_Flash *flash)
+{
+    static const uint8_t fipsKey[MDS_BOOT_CRYPT_KEY_SIZE] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+    };
+    static const uint8_t fipsPlain[MDS_BOOT_CRYPT_BLOCK] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF,
+    };
+    static const uint8_t fipsCipher[MDS_BOOT_CRYPT_BLOCK] = {
+        0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30, 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A,
+    };
+    static const uint8_t ctrKey[MDS_BOOT_CRYPT_KEY_SIZE] = {
+        0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C,
+    };
+    static const uint8_t ctrIv[MDS_BOOT_CRYPT_BLOCK] = {
+        0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF,
+    };
+    static const uint8_t ctrPlain[2 * MDS_BOOT_CRYPT_BLOCK] = {
+        0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+        0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51,
+    };
+    static const uint8_t ctrCipher[2 * MDS_BOOT_CRYPT_BLOCK] = {
+        0x87, 0x4D, 0x61, 0x91, 0xB6, 0x20, 0xE3, 0x26, 0x1B, 0xEF, 0x68, 0x64, 0x99, 0x0D, 0xB6, 0xCE,
+        0x98, 0x06, 0xF6, 0x6B, 0x79, 0x70, 0xFD, 0xFF, 0x86, 0x17, 0x18, 0x7B, 0xB9, 0xFF, 0xFD, 0xFF,
+    };
+    uint8_t data[2 * MDS_BOOT_CRYPT_BLOCK] = {0};
+
+    (void)(flash);
+
+    MDS_BOOT_CryptCtr(fipsKey, fipsPlain, data, MDS_BOOT_CRYPT_BLOCK);
+    if (memcmp(data, fipsCipher, sizeof(fipsCipher)) != 0) {
+        return (1);
+    }
+
+    memcpy(data, ctrPlain, sizeof(data));
+    MDS_BOOT_CryptCtr(ctrKey, ctrIv, data, sizeof(data));
+    if (memcmp(data, ctrCipher, sizeof(ctrCipher)) != 0) {
+        return (1);
+    }
+
+    MDS_BOOT_CryptCtr(ctrKey, ctrIv, data, sizeof(data));
+
+    return ((memcmp(data, ctrPlain, sizeof(ctrPlain)) == 0) ? (0) : (1));
+}
+#endif
+
+#if (defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0))
+// several blocks with a short last one and a raw block the encoder could not shrink, installed by the library
+static int TEST_Lz4(struct TEST_Flash *flash)
+{
+    uint32_t size = (3 * MDS_BOOT_LZ4_BLOCK_SIZE) + (MDS_BOOT_LZ4_BLOCK_SIZE / 3);
+    uint8_t *image = malloc(size);
+    int failed = 1;
+
+    if (image != NULL) {
+        TEST_Image(image, size, 0x4C5A34);
+        for (uint32_t i = MDS_BOOT_LZ4_BLOCK_SIZE, x = 0x52415721; i < (2 * MDS_BOOT_LZ4_BLOCK_SIZE); i++) {
+            x = (x * 1103515245U) + 12345U;
+            image[i] = (uint8_t)(x >> 24);
+        }
+
+        memset(flash->dst.mem, 0xFF, flash->dst.size);
+        if ((TEST_Package(flash, MDS_BOOT_FLAG_LZ4, MDS_BOOT_FLAG_NONE, image, size) == MDS_BOOT_RESULT_SUCCESS) &&
+            (TEST_Install(flash) == MDS_BOOT_RESULT_SUCCESS) && (memcmp(flash->dst.mem, image, size) == 0)) {
+            failed = 0;
+        }
+    }
+    free(image);
+
+    return (failed);
+}
+#endif
+
+#if (defined(MDS_BOOT_WITH_DELTA) && (MDS_BOOT_WITH_DELTA > 0))
+static uint8_t *TEST_DeltaRecord(uint8_t *out, const uint8_t *oldImage, const uint8_t *newImage, uint32_t diffLen,
+                                 uint32_t extraLen, int32_t seek)
+{
+    ALGO_PutU32BE(&(out[0]), diffLen);
+    ALGO_PutU32BE(&(out[sizeof(uint32_t)]), extraLen);
+    ALGO_PutU32BE(&(out[sizeof(uint32_t) + sizeof(uint32_t)]), (uint32_t)(seek));
+    out += TEST_DELTA_CTRL_SIZE;
+
+    for (uint32_t i = 0; i < diffLen; i++) {
+        out[i] = (uint8_t)(newImage[i] - oldImage[i]);
+    }
+    memcpy(&(out[diffLen]), &(newImage[diffLen]), extraLen);
+
+    return (&(out[diffLen + extraLen]));
+}
+
+// old head with a few bytes changed, fresh bytes, the old tail, then the start of the old head once more
+static uint32_t TEST_DeltaPatch(uint8_t *patch, const uint8_t *oldImage, uint32_t oldSize, uint8_t *newImage,
+                                uint32_t newSize)
+{
+    uint32_t head = oldSize / 2, back = newSize - oldSize - TEST_DELTA_INSERT;
+    MDS_BOOT_DeltaInfo_t *info = (MDS_BOOT_DeltaInfo_t *)(patch);
+    ALGO_SHA256_Context_t ctx;
+    ALGO_SHA256_Digest_t digest;
+
+    memcpy(newImage, oldImage, head);
+    for (uint32_t i = 0; i < head; i += 97) {
+        newImage[i] ^= 0x5A;
+    }
+    TEST_Image(&(newImage[head]), TEST_DELTA_INSERT, 0x1D5E27);
+    memcpy(&(newImage[head + TEST_DELTA_INSERT]), &(oldImage[head]), oldSize - head);
+    memcpy(&(newImage[TEST_DELTA_INSERT + oldSize]), oldImage, back);
+
+    ALGO_PutU32BE(info->oldSize, oldSize);
+    ALGO_PutU32BE(info->newSize, newSize);
+    ALGO_SHA256_Init(&ctx);
+    ALGO_SHA256_Update(&ctx, newImage, newSize);
+    ALGO_SHA256_Finish(&ctx, &digest);
+    memcpy(info->hash, digest.hash, sizeof(info->hash));
+
+    uint8_t *rec = &(patch[sizeof(*info)]);
+    rec = TEST_DeltaRecord(rec, oldImage, newImage, head, TEST_DELTA_INSERT, 0);
+    rec = TEST_DeltaRecord(rec, &(oldImage[head]), &(newImage[head + TEST_DELTA_INSERT]), oldSize - head, 0,
+                           -(int32_t)(oldSize));
+    rec = TEST_DeltaRecord(rec, oldImage, &(newImage[TEST_DELTA_INSERT + oldSize]), back, 0, 0);
+
+    return ((uint32_t)(rec - patch));
+}
+
+// a patch whose records diff, insert and seek back over the installed image, then the same with a wrong image hash
+static int TEST_Delta(struct TEST_Flash *flash)
+{
+    uint32_t oldSize = 24U << 10, newSize = oldSize + TEST_DELTA_INSERT + (2U << 10);
+    uint8_t *oldImage = malloc(oldSize), *newImage = malloc(newSize);
+    uint8_t *patch = malloc(sizeof(MDS_BOOT_DeltaInfo_t) + (3 * TEST_DELTA_CTRL_SIZE) + newSize);
+    int failed = 1;
+
+    if ((oldImage != NULL) && (newImage != NULL) && (patch != NULL)) {
+        TEST_Image(oldImage, oldSize, 0x0D1FF);
+        uint32_t patchSize = TEST_DeltaPatch(patch, oldImage, oldSize, newImage, newSize);
+
+        memset(flash->dst.mem, 0xFF, flash->dst.size);
+        memcpy(flash->dst.mem, oldImage, oldSize);
+        MDS_BOOT_SetStageDevice(&(flash->stage.device));
+        if ((TEST_Package(flash, MDS_BOOT_FLAG_COPY, MDS_BOOT_FLAG_DELTA, patch, patchSize) ==
+             MDS_BOOT_RESULT_SUCCESS) &&
+            (TEST_Install(flash) == MDS_BOOT_RESULT_SUCCESS) && (memcmp(flash->dst.mem, newImage, newSize) == 0)) {
+            failed = 0;
+        }
+
+        // the patched image misses its hash, the installed image must stay as it was
+        memcpy(flash->dst.mem, oldImage, oldSize);
+        ((MDS_BOOT_DeltaInfo_t *)(patch))->hash[0] ^= 0x01;
+        if ((failed != 0) ||
+            (TEST_Package(flash, MDS_BOOT_FLAG_COPY, MDS_BOOT_FLAG_DELTA, patch, patchSize) !=
+             MDS_BOOT_RESULT_SUCCESS) ||
+            (TEST_Install(flash) != MDS_BOOT_RESULT_EVERIFY) || (memcmp(flash->dst.mem, oldImage, oldSize) != 0)) {
+            failed = 1;
+        }
+        MDS_BOOT_SetStageDevice(NULL);
+    }
+
+    free(oldImage);
+    free(newImage);
+    free(patch);
+
+    return (failed);
+}
+#endif
+
+static const struct TEST_Case G_TEST_CASE[] = {
+#if (defined(MDS_BOOT_WITH_CRYPT) && (MDS_BOOT_WITH_CRYPT > 0))
+    {"crypt-kat", TEST_CryptKat},
+#endif
+#if (defined(MDS_BOOT_WITH_LZ4) && (MDS_BOOT_WITH_LZ4 > 0))
+    {"lz4-pack", TEST_Lz4},
+#endif
+#if (defined(MDS_BOOT_WITH_DELTA) && (MDS_BOOT_WITH_DELTA > 0))
+    {"delta-apply", TEST_Delta},
+#endif
+    {NULL, NULL},
+};
+
+int main(int argc, char **argv)
+{
+    struct TEST_Flash flash;
+    int failed = 0;
+
+    (void)(argc);
+    (void)(argv);
+
+    if ((MDS_BOOT_SimOpen(&(flash.dst), NULL, TEST_FLASH_SIZE, TEST_SECTOR_SIZE, TEST_PAGE_SIZE) != 0) ||
+        (MDS_BOOT_SimOpen(&(flash.src), NULL, TEST_FLASH_SIZE, TEST_SECTOR_SIZE, TEST_PAGE_SIZE) != 0) ||
+        (MDS_BOOT_SimOpen(&(flash.stage), NULL, TEST_FLASH_SIZE, TEST_SECTOR_SIZE, TEST_PAGE_SIZE) != 0)) {
+        printf("flash open failed\n");
+        return (1);
+    }
+    MDS_BOOT_SimOps(&(flash.ops), &(flash.dst), false);
+
+    for (size_t i = 0; G_TEST_CASE[i].name != NULL; i++) {
+        int res = G_TEST_CASE[i].run(&flash);
+
+        printf("%-14s %s\n", G_TEST_CASE[i].name, (res == 0) ? ("ok") : ("fail"));
+        failed += (res == 0) ? (0) : (1);
+    }
+
+    MDS_BOOT_SimClose(&(flash.dst));
+    MDS_BOOT_SimClose(&(flash.src));
+    MDS_BOOT_SimClose(&(flash.stage));
+
+    return ((failed > 0) ? (1) : (0));
+}